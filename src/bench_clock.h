@@ -0,0 +1,73 @@
+/*
+	2012, Simon Otter
+
+	All rights reserved.
+
+	This is free and unencumbered software released into the public domain.
+
+	Anyone is free to copy, modify, publish, use, compile, sell, or
+	distribute this software, either in source code form or as a compiled
+	binary, for any purpose, commercial or non-commercial, and by any
+	means.
+
+	In jurisdictions that recognize copyright laws, the author or authors
+	of this software dedicate any and all copyright interest in the
+	software to the public domain. We make this dedication for the benefit
+	of the public at large and to the detriment of our heirs and
+	successors. We intend this dedication to be an overt act of
+	relinquishment in perpetuity of all present and future rights to this
+	software under copyright law.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+	OTHER DEALINGS IN THE SOFTWARE.
+
+	For more information, please refer to <http://unlicense.org/>
+*/
+
+/** \file
+
+	bench_clock.h
+
+	The clock and sorting helpers shared by the benchmarks in mknoise.c and 
+	lnbench.c. Define _POSIX_C_SOURCE before including it, for clock_gettime.
+*/
+
+#ifndef BENCH_CLOCK_H
+#define BENCH_CLOCK_H
+
+#include <time.h>
+
+/* Defines _POSIX_TIMERS, without it there is no monotonic clock. */
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+/*
+	Seconds on a monotonic clock. Falls back to processor time where there is
+	no clock_gettime, which counts the time of all threads together.
+*/
+static double bench_now()
+{
+#if defined(_POSIX_TIMERS) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#else
+	return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* For sorting the times of the repetitions with qsort. */
+static int compare_doubles(void const *a, void const *b)
+{
+	double x = *(double const *) a;
+	double y = *(double const *) b;
+	return (x > y) - (x < y);
+}
+
+#endif
@@ -34,274 +34,2369 @@
 	Main implementation.
 */
 
+/* 
+	Lattice creation can be spread over several threads when built with 
+	LN_USE_PTHREADS (make THREADS=1.) 
+
+	On Linux large lattices are also put in transparent huge pages, which 
+	needs madvise from the default (BSD/SVID) feature set.
+*/
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#if defined(LN_USE_PTHREADS) && !defined(_POSIX_C_SOURCE) && !defined(_DEFAULT_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "latticenoise.h"
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
 
 /* For seeding the default RNG. */
 #include <time.h>
 
-/* Some pre-declares. */
-inline static float lerp(float, float, float);
-inline static float catmull_rom(float p0, float p1, float p2, float p3, float x);
-inline static float hermite01(float p0, float m0, float p1, float m1, float t);
+#ifdef LN_USE_PTHREADS
+#include <pthread.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+/* Aligned allocations, posix_memalign is the one that can be freed by free. */
+#if defined(_POSIX_VERSION) && _POSIX_VERSION >= 200112L
+#define LN_HAVE_POSIX_MEMALIGN
+#endif
+
+/* Saved lattices are opened with mmap where there is one. */
+#if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#define LN_HAVE_MMAP
+#endif
+
+#if defined(__linux__) || defined(LN_HAVE_MMAP)
+#include <sys/mman.h>
+#endif
+
+#ifdef LN_HAVE_MMAP
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+/* 
+	Debug builds (make DEBUG=1) check every lattice access the samplers make. 
+*/
+#ifdef DEBUG
+#include <assert.h>
+#define LN_ASSERT(expr) assert(expr)
+#else
+#define LN_ASSERT(expr) ((void) 0)
+#endif
+
+/* Some pre-declares. */
+inline static float lerp(float, float, float);
+inline static float catmull_rom(float p0, float p1, float p2, float p3, float x);
+inline static float hermite01(float p0, float m0, float p1, float m1, float t);
+inline static void cubic_coefficients(
+	float p0, float p1, float p2, float p3, float coeffs[4]);
+
+/* 
+	The default RNG, a SplitMix64 generator. Its state is the uint64_t passed 
+	in through ln_rng_func_def::state, so lattices can be created from several
+	threads at once without sharing anything, unlike with rand().
+*/
+static float default_rng_func(void *state)
+{
+	uint64_t *s = state;
+	uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+	return (float) (z >> 40) * (1.0f / 16777216.0f);
+}
+
+ln_rng_func_def ln_default_rng(unsigned long seed, uint64_t *state)
+{
+	struct ln_rng_func_def_s def = {0};
+
+	def.func = &default_rng_func;
+	def.seed = seed;
+	def.state = state;
+
+	*state = def.seed;
+
+	return def;
+}
+
+/*
+	Sets up the default RNG with its state stored in *state. The seed is 
+	taken from the time, mixed with the address of the lattice so lattices
+	created during the same second still get different values.
+*/
+static ln_rng_func_def default_rng(ln_lattice lattice, uint64_t *state)
+{
+	time_t t = time(NULL);
+	uint64_t address = (uint64_t) (uintptr_t) lattice;
+
+	return ln_default_rng(
+		(unsigned long) t * 241 ^ (unsigned long) (address >> 4) * 2654435761UL, 
+		state);
+}
+
+inline static float clamp01(float v)
+{
+	if (v < 0.0f)
+		return 0.0f;
+	if (v > 1.0f)
+		return 1.0f;
+	return v;
+}
+
+/*
+	The number of bricks along every axis of a bricked lattice.
+*/
+static size_t brick_count(ln_lattice lattice)
+{
+	return (lattice->pitch + LN_BRICK_EDGE - 1) / LN_BRICK_EDGE;
+}
+
+/*
+	The number of values actually stored for the lattice, including the apron
+	and for bricked lattices the padding up to whole bricks.
+*/
+static unsigned long long stored_size(ln_lattice lattice)
+{
+	unsigned long long edge = lattice->pitch;
+	if (lattice->flags & LN_LATTICE_BRICKED)
+		edge = brick_count(lattice) * LN_BRICK_EDGE;
+
+	unsigned long long stored = 1;
+	for (unsigned int i = 0; i < lattice->dimensions; ++i)
+		stored *= edge;
+	return stored;
+}
+
+/*
+	The offset of the value at (0, 0, 0) from the start of the allocated 
+	memory. With an apron there is one leading value along every axis in front
+	of it. Bricked lattices have no such offset, their values pointer is the 
+	start of the memory, see axis_offset.
+*/
+static size_t apron_origin(ln_lattice lattice)
+{
+	if (!(lattice->flags & LN_LATTICE_APRON) 
+		|| (lattice->flags & LN_LATTICE_BRICKED))
+		return 0;
+
+	size_t origin = 0, step = 1;
+	for (unsigned int i = 0; i < lattice->dimensions; ++i)
+	{
+		origin += step;
+		step *= lattice->pitch;
+	}
+	return origin;
+}
+
+/*
+	The distance in values between two neighbouring lattice points along axis
+	of a row-major lattice.
+*/
+inline static ptrdiff_t axis_stride(ln_lattice lattice, unsigned int axis)
+{
+	ptrdiff_t stride = 1;
+	for (unsigned int i = 0; i < axis; ++i)
+		stride *= lattice->pitch;
+	return stride;
+}
+
+/*
+	The distance in values between two neighbouring bricks along axis of a 
+	bricked lattice.
+*/
+inline static ptrdiff_t brick_stride(ln_lattice lattice, unsigned int axis)
+{
+	ptrdiff_t stride = 1;
+	for (unsigned int i = 0; i < lattice->dimensions; ++i)
+		stride *= LN_BRICK_EDGE;
+	for (unsigned int i = 0; i < axis; ++i)
+		stride *= (ptrdiff_t) brick_count(lattice);
+	return stride;
+}
+
+/*
+	The part of the offset of a value that comes from its coordinate i along 
+	axis, i going from -1 to dim_length + 1 with an apron. The offset of a 
+	value is the sum of these over its coordinates, in both layouts.
+
+	In a bricked lattice the coordinate, counted from the start of the apron,
+	splits into the brick and the position within the brick.
+*/
+inline static ptrdiff_t axis_offset(ln_lattice lattice, unsigned int axis, ptrdiff_t i)
+{
+	if (!(lattice->flags & LN_LATTICE_BRICKED))
+		return i * axis_stride(lattice, axis);
+
+	if (lattice->flags & LN_LATTICE_APRON)
+		i += 1;
+	ptrdiff_t local = i % LN_BRICK_EDGE;
+	for (unsigned int a = 0; a < axis; ++a)
+		local *= LN_BRICK_EDGE;
+	return i / LN_BRICK_EDGE * brick_stride(lattice, axis) + local;
+}
+
+/*
+	The size in bytes of one value of the given type.
+*/
+static size_t value_size(unsigned int type)
+{
+	switch (type)
+	{
+		case LN_VALUE_UINT16:
+		case LN_VALUE_HALF:
+			return 2;
+		case LN_VALUE_UINT8:
+			return 1;
+		default:
+			return sizeof(float);
+	}
+}
+
+/* 
+	Quantized values are gathered 4 bytes at a time by the vector kernels, so
+	there must be a few more bytes after the last one.
+*/
+#define GATHER_SLACK 4
+
+/*
+	The number of bytes allocated for the stored values.
+*/
+static size_t storage_bytes(ln_lattice lattice)
+{
+	size_t bytes = (size_t) stored_size(lattice) * value_size(lattice->value_type);
+	if (lattice->flags & LN_LATTICE_QUANTIZED)
+		bytes += GATHER_SLACK;
+	return bytes;
+}
+
+/*
+	The start of the allocated storage, apron included.
+*/
+static char *storage_start(ln_lattice lattice)
+{
+	return (char *) lattice->storage 
+		- apron_origin(lattice) * value_size(lattice->value_type);
+}
+
+/*
+	Converts v, which is in [0.0, 1.0], to a half precision float, rounding to
+	nearest even. Our values never need signs, infinities or NaNs.
+*/
+static uint16_t float_to_half(float v)
+{
+	/* Below 2 ^ -14 halves are subnormal, multiples of 2 ^ -24. */
+	if (v < 6.103515625e-05f)
+		return (uint16_t) lrintf(v * 16777216.0f);
+
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	uint32_t h = (((bits >> 23) - 127 + 15) << 10) | ((bits >> 13) & 0x3ff);
+	uint32_t rest = bits & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		h++;
+	return (uint16_t) h;
+}
+
+/*
+	Moving the bits into place in a float and multiplying by 2 ^ 112 fixes up 
+	the exponent bias, for subnormal halves too. The vector kernels do the 
+	same.
+*/
+inline static float half_to_float(uint16_t h)
+{
+	uint32_t bits = (uint32_t) (h & 0x7fff) << 13;
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f * 0x1p112f;
+}
+
+/*
+	Reads the value at offset from storage of the given type.
+*/
+inline static float load_value(unsigned int type, void const *storage, ptrdiff_t offset)
+{
+	switch (type)
+	{
+		case LN_VALUE_UINT16:
+			return (float) ((uint16_t const *) storage)[offset] * (1.0f / 65535.0f);
+		case LN_VALUE_UINT8:
+			return (float) ((uint8_t const *) storage)[offset] * (1.0f / 255.0f);
+		case LN_VALUE_HALF:
+			return half_to_float(((uint16_t const *) storage)[offset]);
+		default:
+			return ((float const *) storage)[offset];
+	}
+}
+
+/*
+	Writes the n values in src, all in [0.0, 1.0], to storage of the given 
+	type.
+*/
+static void store_values(unsigned int type, void *storage, float const *src, size_t n)
+{
+	switch (type)
+	{
+		case LN_VALUE_UINT16:
+			for (size_t i = 0; i < n; ++i)
+				((uint16_t *) storage)[i] = (uint16_t) lrintf(src[i] * 65535.0f);
+			break;
+		case LN_VALUE_UINT8:
+			for (size_t i = 0; i < n; ++i)
+				((uint8_t *) storage)[i] = (uint8_t) lrintf(src[i] * 255.0f);
+			break;
+		case LN_VALUE_HALF:
+			for (size_t i = 0; i < n; ++i)
+				((uint16_t *) storage)[i] = float_to_half(src[i]);
+			break;
+		default:
+			if (storage != src)
+				memcpy(storage, src, n * sizeof(float));
+			break;
+	}
+}
+
+/*
+	Copies the wrapped values into the apron around the lattice. The apron 
+	spans -1 to dim_length + 1 along every axis.
+
+	It is filled one axis at a time: first the ends of every row, then the 
+	rows above and below each plane and last the planes in front of and 
+	behind the lattice. Each step copies whole rows or planes that the 
+	previous steps already completed.
+*/
+static void fill_apron_bricked(ln_lattice lattice);
+
+static void fill_apron(ln_lattice lattice)
+{
+	if (lattice->flags & LN_LATTICE_BRICKED)
+	{
+		fill_apron_bricked(lattice);
+		return;
+	}
+
+	size_t e = value_size(lattice->value_type);
+	size_t m = lattice->dim_length;
+	size_t pitch = lattice->pitch;
+	size_t ny = lattice->dimensions >= 2 ? m : 1;
+	size_t nz = lattice->dimensions >= 3 ? m : 1;
+	char *values = lattice->storage;
+
+	for (size_t z = 0; z < nz; ++z)
+	for (size_t y = 0; y < ny; ++y)
+	{
+		char *row = values + (z * pitch + y) * pitch * e;
+		memcpy(row - e, row + (m - 1) * e, e);
+		memcpy(row + m * e, row, e);
+		memcpy(row + (m + 1) * e, row + (1 % m) * e, e);
+	}
+
+	if (lattice->dimensions < 2)
+		return;
+
+	size_t const edge[3] = {m - 1, 0, 1 % m};
+	size_t row_bytes = pitch * e;
+	for (size_t z = 0; z < nz; ++z)
+	{
+		char *plane = values + z * pitch * row_bytes - e;
+		memcpy(plane - row_bytes, plane + edge[0] * row_bytes, row_bytes);
+		memcpy(plane + m * row_bytes, plane + edge[1] * row_bytes, row_bytes);
+		memcpy(plane + (m + 1) * row_bytes, plane + edge[2] * row_bytes, row_bytes);
+	}
+
+	if (lattice->dimensions < 3)
+		return;
+
+	size_t slice_bytes = pitch * row_bytes;
+	char *first = values - row_bytes - e;
+	memcpy(first - slice_bytes, first + edge[0] * slice_bytes, slice_bytes);
+	memcpy(first + m * slice_bytes, first + edge[1] * slice_bytes, slice_bytes);
+	memcpy(first + (m + 1) * slice_bytes, first + edge[2] * slice_bytes, slice_bytes);
+}
+
+/*
+	The coordinate in the lattice an apron coordinate wraps to.
+*/
+inline static ptrdiff_t apron_wrap(ptrdiff_t i, ptrdiff_t m)
+{
+	return (i + m) % m;
+}
+
+/*
+	fill_apron for bricked lattices, which always have 3 dimensions if they 
+	have an apron. Rows are not consecutive in memory here, so the values are
+	copied one at a time, skipping over the inside of the lattice.
+*/
+static void fill_apron_bricked(ln_lattice lattice)
+{
+	size_t e = value_size(lattice->value_type);
+	ptrdiff_t m = lattice->dim_length;
+	char *values = lattice->storage;
+
+	for (ptrdiff_t z = -1; z <= m + 1; ++z)
+	for (ptrdiff_t y = -1; y <= m + 1; ++y)
+	{
+		int inside = y >= 0 && y < m && z >= 0 && z < m;
+		ptrdiff_t row = axis_offset(lattice, 1, y) + axis_offset(lattice, 2, z);
+		ptrdiff_t from = axis_offset(lattice, 1, apron_wrap(y, m)) 
+			+ axis_offset(lattice, 2, apron_wrap(z, m));
+		for (ptrdiff_t x = -1; x <= m + 1; ++x)
+		{
+			if (inside && x == 0)
+				x = m;
+			memcpy(
+				values + (row + axis_offset(lattice, 0, x)) * e, 
+				values + (from + axis_offset(lattice, 0, apron_wrap(x, m))) * e, 
+				e);
+		}
+	}
+}
+
+#ifdef DEBUG
+/*
+	Whether offset, relative to lattice->values, is inside the stored values.
+	Only used for the debug assertions.
+*/
+static int offset_valid(ln_lattice lattice, ptrdiff_t offset)
+{
+	if (lattice->flags & LN_LATTICE_PROCEDURAL)
+		return offset >= 0 && offset < (ptrdiff_t) lattice->size;
+
+	ptrdiff_t origin = (ptrdiff_t) apron_origin(lattice);
+	return offset >= -origin 
+		&& offset < (ptrdiff_t) stored_size(lattice) - origin;
+}
+#endif
+
+/*
+	A 32-bit integer hash with good avalanche behaviour (the "lowbias32" 
+	constants by Chris Wellons.) It is a bijection, so distinct inputs never 
+	collide.
+*/
+inline static uint32_t hash32(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x7feb352dU;
+	h ^= h >> 15;
+	h *= 0x846ca68bU;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+	The keys for the counter based generator, derived from the seed.
+*/
+static void counter_keys(unsigned long seed, uint32_t keys[2])
+{
+	unsigned long long s = seed;
+	keys[0] = hash32((uint32_t) s);
+	keys[1] = hash32((uint32_t) (s >> 32) ^ 0x9e3779b9U);
+}
+
+/*
+	The counter based generator: the value at linear index i is a keyed hash 
+	of i, so any value can be computed independently of all the others. The 
+	top 24 bits are turned into a float in [0.0, 1.0).
+*/
+inline static float counter_value(uint32_t const keys[2], uint32_t i)
+{
+	uint32_t h = hash32(hash32(i ^ keys[0]) + keys[1]);
+	/* Going through int32_t gives a plain, vectorizable int to float. */
+	return (float) (int32_t) (h >> 8) * (1.0f / 16777216.0f);
+}
+
+/*
+	Lattices can have more than 2 ^ 32 values. The upper half of the index 
+	then selects a different second key. hash32(0) == 0, so the first 2 ^ 32
+	values are the same as with counter_value.
+*/
+inline static void counter_keys_upper(
+	uint32_t const keys[2], 
+	uint32_t upper, 
+	uint32_t out[2])
+{
+	out[0] = keys[0];
+	out[1] = keys[1] ^ hash32(upper);
+}
+
+inline static float counter_value64(uint32_t const keys[2], uint64_t i)
+{
+	uint32_t upper_keys[2];
+	counter_keys_upper(keys, (uint32_t) (i >> 32), upper_keys);
+	return counter_value(upper_keys, (uint32_t) i);
+}
+
+/*
+	Unchecked accessors, these are what the samplers use to read the lattice.
+
+	The samplers compute the offsets of all their taps up front with 
+	split_coord and footprint, which can only produce offsets inside the 
+	lattice, so there is nothing left to check per tap. The public 
+	ln_lattice_value* functions do their checks once and then use these too.
+
+	In debug builds the offsets are asserted to be valid anyway.
+
+	There is one per way of storing the values. The samplers are instantiated
+	for each of them, see latticenoise_sampler.h, so a tap never has to look 
+	at the flags.
+*/
+inline static float tap_float(ln_lattice lattice, ptrdiff_t offset)
+{
+	LN_ASSERT(offset_valid(lattice, offset));
+	return lattice->values[offset];
+}
+
+/*
+	Procedural lattices have no apron, so an offset is the linear index of the
+	value, which is all counter_value needs.
+*/
+inline static float tap_procedural(ln_lattice lattice, ptrdiff_t offset)
+{
+	LN_ASSERT(offset_valid(lattice, offset));
+	return counter_value64(lattice->keys, (uint64_t) offset);
+}
+
+inline static float tap_uint16(ln_lattice lattice, ptrdiff_t offset)
+{
+	LN_ASSERT(offset_valid(lattice, offset));
+	return load_value(LN_VALUE_UINT16, lattice->storage, offset);
+}
+
+inline static float tap_uint8(ln_lattice lattice, ptrdiff_t offset)
+{
+	LN_ASSERT(offset_valid(lattice, offset));
+	return load_value(LN_VALUE_UINT8, lattice->storage, offset);
+}
+
+inline static float tap_half(ln_lattice lattice, ptrdiff_t offset)
+{
+	LN_ASSERT(offset_valid(lattice, offset));
+	return load_value(LN_VALUE_HALF, lattice->storage, offset);
+}
+
+/*
+	Which of the taps above reads the lattice: its value type, or 
+	STORAGE_PROCEDURAL.
+*/
+#define STORAGE_PROCEDURAL 4
+
+inline static unsigned int storage_kind(ln_lattice lattice)
+{
+	if (lattice->flags & LN_LATTICE_PROCEDURAL)
+		return STORAGE_PROCEDURAL;
+	return lattice->value_type;
+}
+
+/*
+	Calls, or returns the result of, the instantiation of the sampler function 
+	name for the storage of lattice with the parenthesized args.
+*/
+#define STORAGE_CALL(lattice, name, args) \
+	switch (storage_kind(lattice)) \
+	{ \
+		case STORAGE_PROCEDURAL:	name##_procedural args; break; \
+		case LN_VALUE_UINT16:		name##_uint16 args; break; \
+		case LN_VALUE_UINT8:		name##_uint8 args; break; \
+		case LN_VALUE_HALF:			name##_half args; break; \
+		default:					name##_float args; break; \
+	}
+
+#define STORAGE_RETURN(lattice, name, args) \
+	switch (storage_kind(lattice)) \
+	{ \
+		case STORAGE_PROCEDURAL:	return name##_procedural args; \
+		case LN_VALUE_UINT16:		return name##_uint16 args; \
+		case LN_VALUE_UINT8:		return name##_uint8 args; \
+		case LN_VALUE_HALF:			return name##_half args; \
+		default:					return name##_float args; \
+	}
+
+/*
+	Reads a single value, for the ln_lattice_value* functions.
+*/
+inline static float tap(ln_lattice lattice, ptrdiff_t offset)
+{
+	STORAGE_RETURN(lattice, tap, (lattice, offset))
+}
+
+inline static float tap2(ln_lattice lattice, unsigned int x, unsigned int y)
+{
+	return tap(lattice, (ptrdiff_t) y * lattice->pitch + x);
+}
+
+inline static float tap3(
+	ln_lattice lattice, 
+	unsigned int x, 
+	unsigned int y, 
+	unsigned int z)
+{
+	return tap(lattice, axis_offset(lattice, 0, x) + axis_offset(lattice, 1, y) 
+		+ axis_offset(lattice, 2, z));
+}
+
+inline static float tap4(
+	ln_lattice lattice, 
+	unsigned int x, 
+	unsigned int y, 
+	unsigned int z, 
+	unsigned int w)
+{
+	return tap(lattice, axis_offset(lattice, 0, x) + axis_offset(lattice, 1, y) 
+		+ axis_offset(lattice, 2, z) + axis_offset(lattice, 3, w));
+}
+
+/* 
+	Lattices at least this large are aligned to, and padded to a multiple of,
+	the huge page size. With transparent huge pages a random tap then costs 
+	one TLB entry per 2 MB instead of per 4 KB.
+*/
+#define HUGE_PAGE_SIZE ((size_t) 2 << 20)
+
+/*
+	Smaller lattices are aligned to a cache line, so each 4x4 layer of a brick
+	of floats is exactly one cache line.
+*/
+#define CACHE_LINE_SIZE 64
+
+/*
+	Allocates memory for the values. The memory is freed with free.
+*/
+static void *alloc_storage(size_t bytes)
+{
+#ifdef LN_HAVE_POSIX_MEMALIGN
+	if (bytes < HUGE_PAGE_SIZE)
+	{
+		void *memory = NULL;
+		if (posix_memalign(&memory, CACHE_LINE_SIZE, bytes) != 0)
+			return NULL;
+		return memory;
+	}
+	if (bytes <= SIZE_MAX - HUGE_PAGE_SIZE)
+	{
+		void *memory = NULL;
+		size_t padded = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+		if (posix_memalign(&memory, HUGE_PAGE_SIZE, padded) != 0)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		/* Only a hint, the memory is fine without huge pages. */
+		madvise(memory, padded, MADV_HUGEPAGE);
+#endif
+		return memory;
+	}
+#endif
+
+	return malloc(bytes);
+}
+
+/*
+	Sets up a new lattice and allocates the memory for its values, but leaves
+	the values uninitialized. Procedural lattices get no memory for values.
+	The caller checks that bricked lattices have 3 or 4 dimensions.
+*/
+static ln_lattice lattice_alloc(
+	unsigned int dimensions, 
+	unsigned int dim_length, 
+	int procedural,
+	unsigned int value_type,
+	int bricked)
+{
+	if (dimensions < 1 || dim_length < 1)
+		return NULL;
+
+	/* 
+		The samplers address the lattice with ptrdiff_t offsets, so that is 
+		the limit.
+	*/
+	unsigned long long size = 1;
+	for (unsigned int i = 0; i < dimensions; i++)
+	{
+		if (size > (unsigned long long) PTRDIFF_MAX / dim_length)
+			return NULL;
+		size *= (unsigned long long) dim_length;
+	}
+
+	/* Set up the Lattice. */
+	ln_lattice lattice = malloc(sizeof(struct ln_lattice_s));
+	if (lattice == NULL)
+		return NULL;
+
+	lattice->dimensions = dimensions;
+	lattice->dim_length = dim_length;
+	lattice->size = size;
+	lattice->seed = 0;
+	lattice->flags = (dim_length & (dim_length - 1)) == 0 ? LN_LATTICE_POW2 : 0;
+	lattice->pitch = dim_length;
+	lattice->values = NULL;
+	lattice->storage = NULL;
+	lattice->value_type = LN_VALUE_FLOAT;
+	lattice->keys[0] = lattice->keys[1] = 0;
+	if (procedural)
+	{
+		lattice->flags |= LN_LATTICE_PROCEDURAL;
+		return lattice;
+	}
+	if (dimensions <= LN_APRON_MAX_DIMENSIONS)
+	{
+		/* The apron has to fit in the pitch. */
+		if (dim_length > UINT_MAX - 3)
+			goto die_clean;
+		lattice->flags |= LN_LATTICE_APRON;
+		lattice->pitch = dim_length + 3;
+	}
+
+	lattice->value_type = value_type;
+	if (value_type != LN_VALUE_FLOAT)
+		lattice->flags |= LN_LATTICE_QUANTIZED;
+	if (bricked)
+		lattice->flags |= LN_LATTICE_BRICKED;
+
+	unsigned long long stored = stored_size(lattice);
+	if (stored > (SIZE_MAX - GATHER_SLACK) / value_size(value_type))
+		goto die_clean;
+
+	size_t bytes = storage_bytes(lattice);
+	char *storage = alloc_storage(bytes);
+	if (storage == NULL)
+		goto die_clean;
+	/* The bricks pad the lattice with values that are never read. */
+	if (bricked)
+		memset(storage, 0, bytes);
+	else if (lattice->flags & LN_LATTICE_QUANTIZED)
+		memset(storage + bytes - GATHER_SLACK, 0, GATHER_SLACK);
+	lattice->storage = storage + apron_origin(lattice) * value_size(value_type);
+	if (value_type == LN_VALUE_FLOAT)
+		lattice->values = lattice->storage;
+
+	return lattice;
+	
+die_clean:
+	free(lattice);
+
+	lattice = NULL;
+
+	return lattice;
+}
+
+/*
+	The lattice values are generated one row at a time, x fastest, regardless
+	of how they are stored. Row r holds the values with linear indices 
+	r * dim_length to (r + 1) * dim_length - 1.
+
+	This gives where the row is stored in a row-major lattice, bricked 
+	lattices use store_bricked.
+*/
+static void *row_values(ln_lattice lattice, size_t row)
+{
+	char *storage = lattice->storage;
+	size_t e = value_size(lattice->value_type);
+	if (!(lattice->flags & LN_LATTICE_APRON))
+		return storage + row * lattice->dim_length * e;
+
+	size_t pitch = lattice->pitch;
+	size_t ny = lattice->dimensions >= 2 ? lattice->dim_length : 1;
+	return storage + ((row / ny) * pitch + row % ny) * pitch * e;
+}
+
+/*
+	Stores the n values of row starting at x in a bricked lattice.
+*/
+static void store_bricked(
+	ln_lattice lattice, 
+	size_t row, 
+	size_t x, 
+	float const *src, 
+	size_t n)
+{
+	char *storage = lattice->storage;
+	size_t e = value_size(lattice->value_type);
+	size_t m = lattice->dim_length;
+	size_t apron = (lattice->flags & LN_LATTICE_APRON) ? 1 : 0;
+
+	ptrdiff_t base = 0;
+	for (unsigned int axis = 1; axis < lattice->dimensions; ++axis)
+	{
+		base += axis_offset(lattice, axis, (ptrdiff_t) (row % m));
+		row /= m;
+	}
+
+	/* Within a brick the values along x are LN_BRICK_EDGE consecutive ones. */
+	ptrdiff_t stride = brick_stride(lattice, 0);
+	for (size_t i = 0; i < n;)
+	{
+		size_t s = x + i + apron;
+		size_t run = LN_BRICK_EDGE - s % LN_BRICK_EDGE;
+		if (run > n - i)
+			run = n - i;
+		ptrdiff_t offset = base + (ptrdiff_t) (s / LN_BRICK_EDGE) * stride 
+			+ (ptrdiff_t) (s % LN_BRICK_EDGE);
+		/* Too short for the memcpy in store_values to pay off. */
+		if (lattice->value_type == LN_VALUE_FLOAT)
+		{
+			float *to = (float *) storage + offset;
+			for (size_t k = 0; k < run; ++k)
+				to[k] = src[i + k];
+		}
+		else
+			store_values(lattice->value_type, storage + offset * e, src + i, run);
+		i += run;
+	}
+}
+
+/* 
+	Quantized and bricked values are generated this many at a time and then 
+	stored.
+*/
+#define FILL_CHUNK 256
+
+/*
+	Computes the n counter generator values starting at linear index first.
+*/
+static void counter_fill_span(
+	float *out, 
+	uint32_t const keys[2], 
+	uint64_t first, 
+	size_t n)
+{
+	/* Spans crossing a multiple of 2 ^ 32 are rare, do them the slow way. */
+	if (n > 0 && (first >> 32) != ((first + n - 1) >> 32))
+	{
+		for (size_t x = 0; x < n; ++x)
+			out[x] = counter_value64(keys, first + x);
+		return;
+	}
+
+	uint32_t span_keys[2];
+	counter_keys_upper(keys, (uint32_t) (first >> 32), span_keys);
+	uint32_t lower = (uint32_t) first;
+	size_t x = 0;
+	/* Fixed size blocks so the compiler vectorizes the hashing. */
+	for (; x + 8 <= n; x += 8)
+	{
+		float *block = out + x;
+		uint32_t start = lower + (uint32_t) x;
+		for (int l = 0; l < 8; ++l)
+			block[l] = counter_value(span_keys, start + (uint32_t) l);
+	}
+	for (; x < n; ++x)
+		out[x] = counter_value(span_keys, lower + (uint32_t) x);
+}
+
+/*
+	Fills the rows [row_begin, row_end) with the counter based generator.
+*/
+static void counter_fill_rows(
+	ln_lattice lattice, 
+	uint32_t const keys[2], 
+	size_t row_begin, 
+	size_t row_end)
+{
+	unsigned int m = lattice->dim_length;
+	unsigned int type = lattice->value_type;
+	size_t e = value_size(type);
+	int bricked = (lattice->flags & LN_LATTICE_BRICKED) != 0;
+	for (size_t r = row_begin; r < row_end; ++r)
+	{
+		char *row = bricked ? NULL : row_values(lattice, r);
+		uint64_t base = (uint64_t) r * m;
+
+		if (type == LN_VALUE_FLOAT && !bricked)
+		{
+			counter_fill_span((float *) row, keys, base, m);
+			continue;
+		}
+
+		float chunk[FILL_CHUNK];
+		for (size_t x = 0; x < m; x += FILL_CHUNK)
+		{
+			size_t n = m - x < FILL_CHUNK ? m - x : FILL_CHUNK;
+			counter_fill_span(chunk, keys, base + x, n);
+			if (bricked)
+				store_bricked(lattice, r, x, chunk, n);
+			else
+				store_values(type, row + x * e, chunk, n);
+		}
+	}
+}
+
+#ifdef LN_USE_PTHREADS
+struct counter_fill_job
+{
+	ln_lattice lattice;
+	uint32_t const *keys;
+	size_t row_begin;
+	size_t row_end;
+};
+
+static void *counter_fill_thread(void *arg)
+{
+	struct counter_fill_job *job = arg;
+	counter_fill_rows(job->lattice, job->keys, job->row_begin, job->row_end);
+	return NULL;
+}
+#endif
+
+/* Threads are not worth starting for less than this many values each. */
+#define COUNTER_FILL_MIN_VALUES (1u << 16)
+
+/*
+	Fills the lattice with the counter based generator, using up to threads
+	threads (0 = one per processor.) Every value only depends on the seed and 
+	its index, so the result is the same however the rows are divided.
+*/
+static void counter_fill(ln_lattice lattice, unsigned long seed, unsigned int threads)
+{
+	uint32_t keys[2];
+	counter_keys(seed, keys);
+	size_t rows = (size_t) (lattice->size / lattice->dim_length);
+
+#ifdef LN_USE_PTHREADS
+	if (threads == 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned int) cpus : 1;
+	}
+	if (threads > lattice->size / COUNTER_FILL_MIN_VALUES)
+		threads = lattice->size / COUNTER_FILL_MIN_VALUES;
+	if (threads > rows)
+		threads = rows;
+
+	if (threads > 1)
+	{
+		pthread_t *ids = malloc(threads * sizeof(pthread_t));
+		struct counter_fill_job *jobs = malloc(threads * sizeof(*jobs));
+		unsigned int started = 0;
+		if (ids != NULL && jobs != NULL)
+		{
+			for (; started < threads; ++started)
+			{
+				struct counter_fill_job *job = &jobs[started];
+				job->lattice = lattice;
+				job->keys = keys;
+				job->row_begin = rows / threads * started 
+					+ rows % threads * started / threads;
+				job->row_end = rows / threads * (started + 1) 
+					+ rows % threads * (started + 1) / threads;
+				if (pthread_create(&ids[started], NULL, &counter_fill_thread, job))
+					break;
+			}
+		}
+		/* Whatever could not be handed to a thread is done here. */
+		size_t rest = started > 0 ? jobs[started - 1].row_end : 0;
+		counter_fill_rows(lattice, keys, rest, rows);
+		for (unsigned int i = 0; i < started; ++i)
+			pthread_join(ids[i], NULL);
+		free(ids);
+		free(jobs);
+		return;
+	}
+#else
+	(void) threads;
+#endif
+
+	counter_fill_rows(lattice, keys, 0, rows);
+}
+
+/*
+	Fills the lattice with values from a RNG callback, x fastest.
+*/
+static void rng_fill(ln_lattice lattice, ln_rng_func_def *rng_func)
+{
+	unsigned int m = lattice->dim_length;
+	unsigned int type = lattice->value_type;
+	size_t e = value_size(type);
+	size_t rows = (size_t) (lattice->size / m);
+	int bricked = (lattice->flags & LN_LATTICE_BRICKED) != 0;
+	for (size_t r = 0; r < rows; ++r)
+	{
+		char *row = bricked ? NULL : row_values(lattice, r);
+		for (size_t x = 0; x < m; x += FILL_CHUNK)
+		{
+			size_t n = m - x < FILL_CHUNK ? m - x : FILL_CHUNK;
+			float chunk[FILL_CHUNK];
+			float *out = type == LN_VALUE_FLOAT && !bricked ? (float *) row + x : chunk;
+			for (size_t k = 0; k < n; ++k)
+				out[k] = clamp01(rng_func->func(rng_func->state));
+			if (bricked)
+				store_bricked(lattice, r, x, out, n);
+			else
+				store_values(type, row + x * e, out, n);
+		}
+	}
+}
+
+ln_lattice ln_lattice_new(
+	unsigned int dimensions, 
+	unsigned int dim_length,
+	ln_rng_func_def *rng_func)
+{
+	ln_lattice lattice = lattice_alloc(dimensions, dim_length, 0, LN_VALUE_FLOAT, 0);
+	if (lattice == NULL)
+		return NULL;
+	
+	/* only used if rng_func == NULL */
+	ln_rng_func_def default_rng_def = {0};
+	uint64_t default_rng_state = 0;
+	if (!rng_func)
+	{
+		default_rng_def = default_rng(lattice, &default_rng_state);
+		rng_func = &default_rng_def;
+	}
+
+	lattice->seed = rng_func->seed;
+
+	rng_fill(lattice, rng_func);
+	if (lattice->flags & LN_LATTICE_APRON)
+		fill_apron(lattice);
+	
+	return lattice;
+}
+
+ln_lattice_options ln_default_lattice_options()
+{
+	ln_lattice_options options;
+	options.rng_func = NULL;
+	options.seed = 0;
+	options.threads = 0;
+	options.value_type = LN_VALUE_FLOAT;
+	options.layout = LN_LAYOUT_ROW_MAJOR;
+	return options;
+}
+
+ln_lattice ln_lattice_new_with_options(
+	unsigned int dimensions, 
+	unsigned int dim_length, 
+	ln_lattice_options const *options)
+{
+	if (options == NULL 
+		|| (unsigned int) options->value_type > LN_VALUE_HALF
+		|| (unsigned int) options->layout > LN_LAYOUT_BRICKED)
+		return NULL;
+
+	int bricked = options->layout == LN_LAYOUT_BRICKED;
+	if (bricked && dimensions != 3 && dimensions != 4)
+		return NULL;
+
+	ln_lattice lattice = lattice_alloc(
+		dimensions, dim_length, 0, options->value_type, bricked);
+	if (lattice == NULL)
+		return NULL;
+
+	if (options->rng_func != NULL)
+	{
+		lattice->seed = options->rng_func->seed;
+		rng_fill(lattice, options->rng_func);
+	}
+	else
+	{
+		lattice->seed = options->seed;
+		counter_fill(lattice, options->seed, options->threads);
+	}
+	if (lattice->flags & LN_LATTICE_APRON)
+		fill_apron(lattice);
+
+	return lattice;
+}
+
+ln_lattice ln_lattice_new_seeded(
+	unsigned int dimensions, 
+	unsigned int dim_length, 
+	unsigned long seed)
+{
+	ln_lattice_options options = ln_default_lattice_options();
+	options.seed = seed;
+	return ln_lattice_new_with_options(dimensions, dim_length, &options);
+}
+
+ln_lattice ln_lattice_new_procedural(
+	unsigned int dimensions, 
+	unsigned int dim_length, 
+	unsigned long seed)
+{
+	ln_lattice lattice = lattice_alloc(dimensions, dim_length, 1, LN_VALUE_FLOAT, 0);
+	if (lattice == NULL)
+		return NULL;
+
+	lattice->seed = seed;
+	counter_keys(seed, lattice->keys);
+
+	return lattice;
+}
+
+/* 
+	SAVING AND LOADING.
+
+	A lattice file is a header followed by the stored values, apron included, 
+	exactly as they are laid out in memory:
+
+		0		struct lattice_file_header
+		4096	storage_bytes(lattice) bytes of values
+
+	The values start on a page boundary so the file can be mapped and used in 
+	place. Everything is in the byte order of the machine that saved it, 
+	files with another byte order are rejected. Procedural lattices are saved
+	as only the header.
+*/
+#define LATTICE_FILE_MAGIC			"LNLATTIC"
+#define LATTICE_FILE_VERSION		2
+#define LATTICE_FILE_BYTE_ORDER		0x01020304U
+#define LATTICE_FILE_DATA_OFFSET	4096
+
+/* 
+	The flags a file can have. LN_LATTICE_MAPPED only describes the lattice in
+	memory and is never written.
+*/
+#define LATTICE_FILE_FLAGS	(LN_LATTICE_POW2 | LN_LATTICE_APRON \
+	| LN_LATTICE_PROCEDURAL | LN_LATTICE_QUANTIZED | LN_LATTICE_BRICKED)
+
+struct lattice_file_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t dimensions;
+	uint32_t dim_length;
+	uint32_t flags;
+	uint32_t pitch;
+	uint32_t value_type;
+	uint32_t reserved;
+	uint64_t seed;
+	uint64_t size;
+	/* The number of values after the header, 0 for procedural lattices. */
+	uint64_t stored;
+	uint64_t checksum;
+};
+
+/*
+	FNV-1a over the stored bytes, a word at a time. It is only there to catch 
+	truncated or damaged files.
+*/
+static uint64_t storage_checksum(char const *storage, size_t bytes)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i = 0;
+	for (; i + 4 <= bytes; i += 4)
+	{
+		uint32_t word;
+		memcpy(&word, storage + i, sizeof(word));
+		h = (h ^ word) * 0x100000001b3ULL;
+	}
+	for (; i < bytes; ++i)
+		h = (h ^ (unsigned char) storage[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+/*
+	The whole mapping of a lattice opened with mmap, header included.
+*/
+#ifdef LN_HAVE_MMAP
+static void *mapping_start(ln_lattice lattice)
+{
+	return storage_start(lattice) - LATTICE_FILE_DATA_OFFSET;
+}
+
+static size_t mapping_length(ln_lattice lattice)
+{
+	return LATTICE_FILE_DATA_OFFSET + storage_bytes(lattice);
+}
+#endif
+
+/* 
+	Counts the temporary files created, so that every save gets its own even
+	when several threads save to the same path.
+*/
+static unsigned long temporary_count = 0;
+
+static unsigned long next_temporary(void)
+{
+#ifdef __GNUC__
+	return __atomic_fetch_add(&temporary_count, 1, __ATOMIC_RELAXED);
+#else
+	return temporary_count++;
+#endif
+}
+
+/* Gives up after this many names that are already taken. */
+#define TEMPORARY_ATTEMPTS 100
+
+/*
+	Creates the file a lattice is written to before it is renamed to path, 
+	next to path so that the rename stays within one file system. The name is 
+	put in tmp, which holds strlen(path) + 64 characters.
+
+	The name has the process id and a counter in it. A file left behind by a
+	save that was killed can still have the same name, so names that are 
+	taken are skipped.
+*/
+static FILE *open_temporary(char const *path, char *tmp)
+{
+#ifdef LN_HAVE_MMAP
+	for (unsigned int attempt = 0; attempt < TEMPORARY_ATTEMPTS; ++attempt)
+	{
+		sprintf(tmp, "%s.%ld.%lu.tmp", path, (long) getpid(), next_temporary());
+		int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if (fd == -1)
+		{
+			if (errno == EEXIST)
+				continue;
+			return NULL;
+		}
+		FILE *file = fdopen(fd, "wb");
+		if (file == NULL)
+		{
+			close(fd);
+			remove(tmp);
+		}
+		return file;
+	}
+	return NULL;
+#else
+	sprintf(tmp, "%s.%lu.tmp", path, next_temporary());
+	return fopen(tmp, "wb");
+#endif
+}
+
+int ln_lattice_save(ln_lattice lattice, char const *path)
+{
+	if (lattice == NULL || path == NULL)
+		return 0;
+
+	int procedural = (lattice->flags & LN_LATTICE_PROCEDURAL) != 0;
+	char const *first = procedural ? NULL : storage_start(lattice);
+	size_t bytes = procedural ? 0 : storage_bytes(lattice);
+
+	struct lattice_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LATTICE_FILE_MAGIC, sizeof(header.magic));
+	header.version = LATTICE_FILE_VERSION;
+	header.byte_order = LATTICE_FILE_BYTE_ORDER;
+	header.dimensions = lattice->dimensions;
+	header.dim_length = lattice->dim_length;
+	header.flags = lattice->flags & LATTICE_FILE_FLAGS;
+	header.pitch = lattice->pitch;
+	header.value_type = lattice->value_type;
+	header.seed = lattice->seed;
+	header.size = lattice->size;
+	header.stored = procedural ? 0 : stored_size(lattice);
+	header.checksum = storage_checksum(first, bytes);
+
+	/*
+		The lattice is written to a temporary file that then replaces path. 
+		Processes that have the old file mapped keep their copy of it, where 
+		truncating it would make their next access fault, and if writing 
+		fails the old file is still there.
+	*/
+	char *tmp = malloc(strlen(path) + 64);
+	if (tmp == NULL)
+		return 0;
+	FILE *file = open_temporary(path, tmp);
+	if (file == NULL)
+	{
+		free(tmp);
+		return 0;
+	}
+
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	
+	/* Pad the header to the page boundary. */
+	static char const zeros[LATTICE_FILE_DATA_OFFSET] = {0};
+	if (ok && !procedural)
+	{
+		ok = fwrite(zeros, LATTICE_FILE_DATA_OFFSET - sizeof(header), 1, file) == 1
+			&& fwrite(first, 1, bytes, file) == bytes;
+	}
+
+	if (fclose(file) != 0)
+		ok = 0;
+	if (ok && rename(tmp, path) != 0)
+	{
+		/* Where rename does not replace existing files. */
+		remove(path);
+		ok = rename(tmp, path) == 0;
+	}
+	if (!ok)
+		remove(tmp);
+
+	free(tmp);
+	return ok;
+}
+
+/*
+	Checks that a header describes a lattice this build could have created 
+	and sets up a lattice from it, without any values.
+*/
+static ln_lattice lattice_from_header(struct lattice_file_header const *header)
+{
+	if (memcmp(header->magic, LATTICE_FILE_MAGIC, sizeof(header->magic)) != 0
+		|| header->version != LATTICE_FILE_VERSION
+		|| header->byte_order != LATTICE_FILE_BYTE_ORDER
+		|| (header->flags & ~LATTICE_FILE_FLAGS) != 0
+		|| header->value_type > LN_VALUE_HALF)
+		return NULL;
+
+	int procedural = (header->flags & LN_LATTICE_PROCEDURAL) != 0;
+	ln_lattice lattice = lattice_alloc(
+		header->dimensions, header->dim_length, 1, LN_VALUE_FLOAT, 0);
+	if (lattice == NULL)
+		return NULL;
+
+	lattice->flags = header->flags;
+	lattice->pitch = header->pitch;
+	lattice->value_type = header->value_type;
+	lattice->seed = (unsigned long) header->seed;
+
+	/* The layout has to be the one ln_lattice_new would have picked. */
+	int apron = !procedural && header->dimensions <= LN_APRON_MAX_DIMENSIONS;
+	int pow2 = (header->dim_length & (header->dim_length - 1)) == 0;
+	int quantized = header->value_type != LN_VALUE_FLOAT;
+	int bricked = (header->flags & LN_LATTICE_BRICKED) != 0;
+	if (lattice->size != header->size
+		|| ((header->flags & LN_LATTICE_APRON) != 0) != apron
+		|| ((header->flags & LN_LATTICE_POW2) != 0) != pow2
+		|| ((header->flags & LN_LATTICE_QUANTIZED) != 0) != quantized
+		|| (procedural && quantized)
+		|| (bricked && (procedural 
+			|| (header->dimensions != 3 && header->dimensions != 4)))
+		|| (uint64_t) header->pitch 
+			!= (uint64_t) header->dim_length + (apron ? 3 : 0)
+		|| header->stored != (procedural ? 0 : stored_size(lattice))
+		|| header->stored > (SIZE_MAX - LATTICE_FILE_DATA_OFFSET - GATHER_SLACK) 
+			/ value_size(header->value_type))
+	{
+		free(lattice);
+		return NULL;
+	}
+
+	if (procedural)
+		counter_keys(lattice->seed, lattice->keys);
+
+	return lattice;
+}
+
+ln_lattice ln_lattice_open(char const *path, int verify)
+{
+	if (path == NULL)
+		return NULL;
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return NULL;
+
+	struct lattice_file_header header;
+	ln_lattice lattice = NULL;
+	if (fread(&header, sizeof(header), 1, file) == 1)
+		lattice = lattice_from_header(&header);
+	if (lattice == NULL || (lattice->flags & LN_LATTICE_PROCEDURAL))
+	{
+		fclose(file);
+		return lattice;
+	}
+
+	size_t bytes = storage_bytes(lattice);
+	char *first = NULL;
+
+#ifdef LN_HAVE_MMAP
+	/* 
+		Map the whole file read only and shared, so all processes using the 
+		same file share one copy in the page cache.
+	*/
+	size_t length = LATTICE_FILE_DATA_OFFSET + bytes;
+	struct stat info;
+	int fd = fileno(file);
+	if (fstat(fd, &info) == 0 && (unsigned long long) info.st_size >= length)
+	{
+		void *mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapping != MAP_FAILED)
+		{
+			first = (char *) mapping + LATTICE_FILE_DATA_OFFSET;
+			lattice->flags |= LN_LATTICE_MAPPED;
+		}
+	}
+#else
+	first = alloc_storage(bytes);
+	if (first != NULL 
+		&& (fseek(file, LATTICE_FILE_DATA_OFFSET, SEEK_SET) != 0
+			|| fread(first, 1, bytes, file) != bytes))
+	{
+		free(first);
+		first = NULL;
+	}
+#endif
+	fclose(file);
+
+	if (first == NULL)
+	{
+		free(lattice);
+		return NULL;
+	}
+	lattice->storage = first + apron_origin(lattice) * value_size(lattice->value_type);
+	if (lattice->value_type == LN_VALUE_FLOAT)
+		lattice->values = lattice->storage;
+
+	if (verify && storage_checksum(first, bytes) != header.checksum)
+	{
+		ln_lattice_free(lattice);
+		return NULL;
+	}
+
+	return lattice;
+}
+
+void ln_lattice_free(ln_lattice lattice)
+{
+#ifdef LN_HAVE_MMAP
+	if (lattice->flags & LN_LATTICE_MAPPED)
+	{
+		munmap(mapping_start(lattice), mapping_length(lattice));
+		free(lattice);
+		return;
+	}
+#endif
+	if (lattice->storage != NULL)
+		free(storage_start(lattice));
+	free(lattice);
+}
+
+float ln_lattice_value1(
+	ln_lattice lattice, 
+	unsigned int x)
+{
+	if (lattice == NULL || lattice->dimensions != 1 || x >= lattice->dim_length)
+		return INFINITY;
+	return tap(lattice, x);
+}
+
+float ln_lattice_value2(
+	ln_lattice lattice, 
+	unsigned int x,
+	unsigned int y)
+{
+	if (lattice == NULL 
+		|| lattice->dimensions != 2 
+		|| x >= lattice->dim_length
+		|| y >= lattice->dim_length)
+		return INFINITY;
+	return tap2(lattice, x, y);
+}
+
+float ln_lattice_value3(
+	ln_lattice lattice, 
+	unsigned int x,
+	unsigned int y,
+	unsigned int z)
+{
+	if (lattice == NULL 
+		|| lattice->dimensions != 3 
+		|| x >= lattice->dim_length
+		|| y >= lattice->dim_length
+		|| z >= lattice->dim_length)
+		return INFINITY;
+	return tap3(lattice, x, y, z);
+}
+
+float ln_lattice_value4(
+	ln_lattice lattice, 
+	unsigned int x,
+	unsigned int y,
+	unsigned int z,
+	unsigned int w)
+{
+	if (lattice == NULL 
+		|| lattice->dimensions != 4 
+		|| x >= lattice->dim_length
+		|| y >= lattice->dim_length
+		|| z >= lattice->dim_length
+		|| w >= lattice->dim_length)
+		return INFINITY;
+	return tap4(lattice, x, y, z, w);
+}
+
+/*
+	Simply takes the value modulo dim_length to ensure we are always inside the
+	lattice.
+*/
+#define WRAP(offset) ((offset) % lattice->dim_length)
+/*
+	The index before offset, wrapped. WRAP(offset - 1) would underflow for 
+	offset 0 and only land on the last element when dim_length is a power of 
+	two.
+*/
+#define WRAP_DEC(offset) ((offset) == 0 ? lattice->dim_length - 1 : (offset) - 1)
+
+/*
+	Non-negative coordinates below this fit in an unsigned int, so they can be 
+	floored with a plain conversion.
+*/
+#define FAST_FLOOR_LIMIT 2147483648.0f
+
+/*
+	Maps a coordinate into the lattice space and splits it into a lattice 
+	index and the fractional part, which is used for interpolating between
+	lattice points.
+
+	For power of two lattices we floor and mask, otherwise we reduce the 
+	coordinate with fmodf first. Both give exactly the same result, as
+	v - floor(v) is exact.
+*/
+inline static unsigned int split_coord(ln_lattice lattice, float v, float *frac)
+{
+	v = fabs(v);
+	if ((lattice->flags & LN_LATTICE_POW2) && v < FAST_FLOOR_LIMIT)
+	{
+		unsigned int i = (unsigned int) v;
+		*frac = v - (float) i;
+		return i & (lattice->dim_length - 1);
+	}
+
+	v = fmodf(v, (float) lattice->dim_length);
+	float fi;
+	*frac = modff(v, &fi);
+	/*
+		lattice->dim_length is unsigned int, and we have already computed v 
+		modulo dim_length, so fi will always fit into an unsigned int.
+	*/
+	return (unsigned int) fi;
+}
+
+/*
+	Gives the offsets into lattice->values, along one axis, of the four lattice
+	points the cubic interpolation uses around index: index - 1, index, 
+	index + 1 and index + 2. stride is the distance between two neighbouring 
+	values along the axis.
+
+	With an apron the four points are simply consecutive, the wrapped values 
+	are already stored around the edges. Otherwise we wrap them here.
+*/
+inline static void footprint_strided(
+	ln_lattice lattice, 
+	unsigned int index, 
+	ptrdiff_t stride, 
+	ptrdiff_t off[4])
+{
+	if (lattice->flags & LN_LATTICE_APRON)
+	{
+		ptrdiff_t base = ((ptrdiff_t) index - 1) * stride;
+		off[0] = base;
+		off[1] = base + stride;
+		off[2] = base + stride * 2;
+		off[3] = base + stride * 3;
+	}
+	else if (lattice->flags & LN_LATTICE_POW2)
+	{
+		unsigned int mask = lattice->dim_length - 1;
+		off[0] = ((index - 1) & mask) * stride;
+		off[1] = index * stride;
+		off[2] = ((index + 1) & mask) * stride;
+		off[3] = ((index + 2) & mask) * stride;
+	}
+	else
+	{
+		off[0] = WRAP_DEC(index) * stride;
+		off[1] = index * stride;
+		off[2] = WRAP(index + 1) * stride;
+		off[3] = WRAP(index + 2) * stride;
+	}
+}
+
+/*
+	The same along the given axis of the lattice, in either layout. The offset
+	of a tap is the sum of its offsets along each axis.
+
+	For bricked lattices we get the coordinates of the four points with a 
+	stride of 1 and look up where they are stored.
+*/
+inline static void footprint(
+	ln_lattice lattice, 
+	unsigned int index, 
+	unsigned int axis, 
+	ptrdiff_t off[4])
+{
+	if (lattice->flags & LN_LATTICE_BRICKED)
+	{
+		footprint_strided(lattice, index, 1, off);
+		for (unsigned int t = 0; t < 4; ++t)
+			off[t] = axis_offset(lattice, axis, off[t]);
+		return;
+	}
+
+	footprint_strided(lattice, index, axis_stride(lattice, axis), off);
+}
+
+/*
+	The cubic interpolation used by the samplers along each axis. It 
+	interpolates between p1 and p2, t is the position between them.
+*/
+inline static float cubic(float p0, float p1, float p2, float p3, float t)
+{
+#ifdef LN_DEFAULT_HERMITE_INTERPOLATION
+	/* 
+		We use the slope between p0, p2 and p1, p3 here as tangents.
+		It gives a reasonably smooth "continous" interpolation.
+	*/
+	return hermite01(p1, (p2 - p0) / 3.0f, p2, (p3 - p1) / 3.0f, t);
+#else
+	/* 
+		For Catmull-Rom we just use the samples as four points.
+		
+		The Catmull-Rom interpolation is guaranteed to go through the 
+		points.
+	*/
+	return catmull_rom(p0, p1, p2, p3, t);
+#endif
+}
+
+/*
+	The 4D samplers' footprint.
+
+	4D lattices have no apron, so footprint wraps the offsets, but it does so
+	once per axis and sample rather than per tap.
+*/
+inline static void footprint4(
+	ln_lattice lattice, 
+	float x, float y, float z, float w, 
+	float r[4], 
+	ptrdiff_t off[4][4])
+{
+	footprint(lattice, split_coord(lattice, x, &r[0]), 0, off[0]);
+	footprint(lattice, split_coord(lattice, y, &r[1]), 1, off[1]);
+	footprint(lattice, split_coord(lattice, z, &r[2]), 2, off[2]);
+	footprint(lattice, split_coord(lattice, w, &r[3]), 3, off[3]);
+}
+
+/*
+	The samplers, once per tap function.
+*/
+#define LNS(name) name##_float
+#include "latticenoise_sampler.h"
+#undef LNS
+
+#define LNS(name) name##_procedural
+#include "latticenoise_sampler.h"
+#undef LNS
+
+#define LNS(name) name##_uint16
+#include "latticenoise_sampler.h"
+#undef LNS
+
+#define LNS(name) name##_uint8
+#include "latticenoise_sampler.h"
+#undef LNS
+
+#define LNS(name) name##_half
+#include "latticenoise_sampler.h"
+#undef LNS
+
+/*
+	The samplers for any lattice. They pick the instantiation for its storage 
+	once and do no validation, callers must make sure the lattice has the 
+	right number of dimensions first.
+*/
+inline static float noise1d_sample(ln_lattice lattice, float x)
+{
+	STORAGE_RETURN(lattice, noise1d_sample, (lattice, x))
+}
+
+inline static float noise2d_sample(ln_lattice lattice, float x, float y)
+{
+	STORAGE_RETURN(lattice, noise2d_sample, (lattice, x, y))
+}
+
+inline static float noise3d_sample(ln_lattice lattice, float x, float y, float z)
+{
+	STORAGE_RETURN(lattice, noise3d_sample, (lattice, x, y, z))
+}
+
+inline static float noise4d_sample(
+	ln_lattice lattice, 
+	float x, float y, float z, float w)
+{
+	STORAGE_RETURN(lattice, noise4d_sample, (lattice, x, y, z, w))
+}
+
+inline static float noise4d_smooth_sample(
+	ln_lattice lattice, 
+	float x, float y, float z, float w)
+{
+	STORAGE_RETURN(lattice, noise4d_smooth_sample, (lattice, x, y, z, w))
+}
+
+float ln_lattice_noise1d(ln_lattice lattice, float x)
+{
+	if (lattice == NULL || lattice->dimensions != 1)
+		return INFINITY;
+	return noise1d_sample(lattice, x);
+}
+
+/* 
+	SIMD KERNELS.
+	---------------------------------------------------------------------------------
+
+	The batch samplers hand their work to the widest vector kernel the CPU 
+	supports, selected at runtime. Define LN_NO_SIMD to build without them.
+*/
+#if !defined(LN_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LN_SIMD_X86 1
+#include <immintrin.h>
+
+/*
+	Coordinates at or above this are handed to the scalar samplers, below it 
+	the vector kernels can do the modulo reduction exactly in float.
+*/
+#define SIMD_COORD_LIMIT 8388608.0f
+
+/*
+	Whether the vector kernels can sample the given lattice, which has already
+	been validated for the sampler's dimensionality. They rely on the apron, 
+	and the gathers use signed 32-bit indices.
+*/
+static int simd_supported(ln_lattice lattice)
+{
+	return (lattice->flags & LN_LATTICE_APRON)
+		&& stored_size(lattice) <= INT_MAX;
+}
+
+/* SSE4.1, 4 lanes. There is no gather instruction so we emulate it. */
+__attribute__((target("sse4.1")))
+static inline __m128 sse41_gather(float const *p, __m128i idx)
+{
+	return _mm_set_ps(
+		p[_mm_extract_epi32(idx, 3)],
+		p[_mm_extract_epi32(idx, 2)],
+		p[_mm_extract_epi32(idx, 1)],
+		p[_mm_extract_epi32(idx, 0)]);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i sse41_gather_epi32(char const *p, __m128i idx, ptrdiff_t scale)
+{
+	int32_t v[4];
+	memcpy(&v[0], p + _mm_extract_epi32(idx, 0) * scale, 4);
+	memcpy(&v[1], p + _mm_extract_epi32(idx, 1) * scale, 4);
+	memcpy(&v[2], p + _mm_extract_epi32(idx, 2) * scale, 4);
+	memcpy(&v[3], p + _mm_extract_epi32(idx, 3) * scale, 4);
+	return _mm_loadu_si128((__m128i const *) v);
+}
+
+#define LNV(name)			name##_sse41
+#define LNV_TARGET			__attribute__((target("sse4.1")))
+#define LNV_W				4
+#define VF					__m128
+#define VI					__m128i
+#define VM					__m128
+#define VF_LOAD(p)			_mm_loadu_ps(p)
+#define VF_STORE(p, v)		_mm_storeu_ps(p, v)
+#define VF_SET1(f)			_mm_set1_ps(f)
+#define VF_ADD(a, b)		_mm_add_ps(a, b)
+#define VF_SUB(a, b)		_mm_sub_ps(a, b)
+#define VF_MUL(a, b)		_mm_mul_ps(a, b)
+#define VF_DIV(a, b)		_mm_div_ps(a, b)
+#define VF_MIN(a, b)		_mm_min_ps(a, b)
+#define VF_MAX(a, b)		_mm_max_ps(a, b)
+#define VF_ABS(v)			_mm_andnot_ps(_mm_set1_ps(-0.0f), v)
+#define VF_FLOOR(v)			_mm_floor_ps(v)
+#define VF_LT(a, b)			_mm_cmplt_ps(a, b)
+#define VF_ADD_IF(m, a, b)	_mm_add_ps(a, _mm_and_ps(m, b))
+#define VM_AND(a, b)		_mm_and_ps(a, b)
+#define VM_ALL(m)			(_mm_movemask_ps(m) == 0xF)
+#define VF_TO_VI(v)			_mm_cvttps_epi32(v)
+#define VI_ADD(a, b)		_mm_add_epi32(a, b)
+#define VI_MUL(a, b)		_mm_mullo_epi32(a, b)
+#define VI_AND(a, b)		_mm_and_si128(a, b)
+#define VI_SET1(i)			_mm_set1_epi32(i)
+#define VI_SLL(v, n)		_mm_slli_epi32(v, n)
+#define VI_SRL(v, n)		_mm_srli_epi32(v, n)
+#define VI_TO_VF(v)			_mm_cvtepi32_ps(v)
+#define VI_AS_VF(v)			_mm_castsi128_ps(v)
+#define VF_GATHER(p, idx)	sse41_gather(p, idx)
+#define VI_GATHER(p, idx, scale)	sse41_gather_epi32(p, idx, scale)
+#include "latticenoise_simd.h"
+#undef LNV
+#undef LNV_TARGET
+#undef LNV_W
+#undef VF
+#undef VI
+#undef VM
+#undef VF_LOAD
+#undef VF_STORE
+#undef VF_SET1
+#undef VF_ADD
+#undef VF_SUB
+#undef VF_MUL
+#undef VF_DIV
+#undef VF_MIN
+#undef VF_MAX
+#undef VF_ABS
+#undef VF_FLOOR
+#undef VF_LT
+#undef VF_ADD_IF
+#undef VM_AND
+#undef VM_ALL
+#undef VF_TO_VI
+#undef VI_ADD
+#undef VI_MUL
+#undef VI_AND
+#undef VI_SET1
+#undef VI_SLL
+#undef VI_SRL
+#undef VI_TO_VF
+#undef VI_AS_VF
+#undef VF_GATHER
+#undef VI_GATHER
+
+/* AVX2, 8 lanes. */
+#define LNV(name)			name##_avx2
+#define LNV_TARGET			__attribute__((target("avx2")))
+#define LNV_W				8
+#define VF					__m256
+#define VI					__m256i
+#define VM					__m256
+#define VF_LOAD(p)			_mm256_loadu_ps(p)
+#define VF_STORE(p, v)		_mm256_storeu_ps(p, v)
+#define VF_SET1(f)			_mm256_set1_ps(f)
+#define VF_ADD(a, b)		_mm256_add_ps(a, b)
+#define VF_SUB(a, b)		_mm256_sub_ps(a, b)
+#define VF_MUL(a, b)		_mm256_mul_ps(a, b)
+#define VF_DIV(a, b)		_mm256_div_ps(a, b)
+#define VF_MIN(a, b)		_mm256_min_ps(a, b)
+#define VF_MAX(a, b)		_mm256_max_ps(a, b)
+#define VF_ABS(v)			_mm256_andnot_ps(_mm256_set1_ps(-0.0f), v)
+#define VF_FLOOR(v)			_mm256_floor_ps(v)
+#define VF_LT(a, b)			_mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define VF_ADD_IF(m, a, b)	_mm256_add_ps(a, _mm256_and_ps(m, b))
+#define VM_AND(a, b)		_mm256_and_ps(a, b)
+#define VM_ALL(m)			(_mm256_movemask_ps(m) == 0xFF)
+#define VF_TO_VI(v)			_mm256_cvttps_epi32(v)
+#define VI_ADD(a, b)		_mm256_add_epi32(a, b)
+#define VI_MUL(a, b)		_mm256_mullo_epi32(a, b)
+#define VI_AND(a, b)		_mm256_and_si256(a, b)
+#define VI_SET1(i)			_mm256_set1_epi32(i)
+#define VI_SLL(v, n)		_mm256_slli_epi32(v, n)
+#define VI_SRL(v, n)		_mm256_srli_epi32(v, n)
+#define VI_TO_VF(v)			_mm256_cvtepi32_ps(v)
+#define VI_AS_VF(v)			_mm256_castsi256_ps(v)
+#define VF_GATHER(p, idx)	_mm256_i32gather_ps(p, idx, 4)
+#define VI_GATHER(p, idx, scale)	_mm256_i32gather_epi32((int const *) (p), idx, scale)
+#include "latticenoise_simd.h"
+#undef LNV
+#undef LNV_TARGET
+#undef LNV_W
+#undef VF
+#undef VI
+#undef VM
+#undef VF_LOAD
+#undef VF_STORE
+#undef VF_SET1
+#undef VF_ADD
+#undef VF_SUB
+#undef VF_MUL
+#undef VF_DIV
+#undef VF_MIN
+#undef VF_MAX
+#undef VF_ABS
+#undef VF_FLOOR
+#undef VF_LT
+#undef VF_ADD_IF
+#undef VM_AND
+#undef VM_ALL
+#undef VF_TO_VI
+#undef VI_ADD
+#undef VI_MUL
+#undef VI_AND
+#undef VI_SET1
+#undef VI_SLL
+#undef VI_SRL
+#undef VI_TO_VF
+#undef VI_AS_VF
+#undef VF_GATHER
+#undef VI_GATHER
+
+/* AVX-512F, 16 lanes. Comparisons give mask registers here. */
+#define LNV(name)			name##_avx512
+#define LNV_TARGET			__attribute__((target("avx512f")))
+#define LNV_W				16
+#define VF					__m512
+#define VI					__m512i
+#define VM					__mmask16
+#define VF_LOAD(p)			_mm512_loadu_ps(p)
+#define VF_STORE(p, v)		_mm512_storeu_ps(p, v)
+#define VF_SET1(f)			_mm512_set1_ps(f)
+#define VF_ADD(a, b)		_mm512_add_ps(a, b)
+#define VF_SUB(a, b)		_mm512_sub_ps(a, b)
+#define VF_MUL(a, b)		_mm512_mul_ps(a, b)
+#define VF_DIV(a, b)		_mm512_div_ps(a, b)
+#define VF_MIN(a, b)		_mm512_min_ps(a, b)
+#define VF_MAX(a, b)		_mm512_max_ps(a, b)
+#define VF_ABS(v)			_mm512_abs_ps(v)
+#define VF_FLOOR(v)			_mm512_roundscale_ps(v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)
+#define VF_LT(a, b)			_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ)
+#define VF_ADD_IF(m, a, b)	_mm512_mask_add_ps(a, m, a, b)
+#define VM_AND(a, b)		((__mmask16) ((a) & (b)))
+#define VM_ALL(m)			((m) == 0xFFFF)
+#define VF_TO_VI(v)			_mm512_cvttps_epi32(v)
+#define VI_ADD(a, b)		_mm512_add_epi32(a, b)
+#define VI_MUL(a, b)		_mm512_mullo_epi32(a, b)
+#define VI_AND(a, b)		_mm512_and_si512(a, b)
+#define VI_SET1(i)			_mm512_set1_epi32(i)
+#define VI_SLL(v, n)		_mm512_slli_epi32(v, n)
+#define VI_SRL(v, n)		_mm512_srli_epi32(v, n)
+#define VI_TO_VF(v)			_mm512_cvtepi32_ps(v)
+#define VI_AS_VF(v)			_mm512_castsi512_ps(v)
+#define VF_GATHER(p, idx)	_mm512_i32gather_ps(idx, p, 4)
+#define VI_GATHER(p, idx, scale)	_mm512_i32gather_epi32(idx, p, scale)
+#include "latticenoise_simd.h"
+#undef LNV
+#undef LNV_TARGET
+#undef LNV_W
+#undef VF
+#undef VI
+#undef VM
+#undef VF_LOAD
+#undef VF_STORE
+#undef VF_SET1
+#undef VF_ADD
+#undef VF_SUB
+#undef VF_MUL
+#undef VF_DIV
+#undef VF_MIN
+#undef VF_MAX
+#undef VF_ABS
+#undef VF_FLOOR
+#undef VF_LT
+#undef VF_ADD_IF
+#undef VM_AND
+#undef VM_ALL
+#undef VF_TO_VI
+#undef VI_ADD
+#undef VI_MUL
+#undef VI_AND
+#undef VI_SET1
+#undef VI_SLL
+#undef VI_SRL
+#undef VI_TO_VF
+#undef VI_AS_VF
+#undef VF_GATHER
+#undef VI_GATHER
+
+/*
+	Whether the batch samplers below run one of the kernels with hardware 
+	gathers, AVX2 or AVX-512, for lattice. The SSE4.1 kernel emulates them and
+	is a few times slower.
+*/
+static int simd_gather_available(ln_lattice lattice)
+{
+	return simd_supported(lattice) 
+		&& (__builtin_cpu_supports("avx512f") || __builtin_cpu_supports("avx2"));
+}
+
+/*
+	Runs the widest supported kernel over the batch.
+
+	\return		1 if a vector kernel did the work, 0 if the caller has to fall 
+				back to the scalar loop.
+*/
+static int simd_noise2d_batch(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float *out, 
+	size_t n)
+{
+	if (!simd_supported(lattice))
+		return 0;
+
+	if (__builtin_cpu_supports("avx512f"))
+		noise2d_batch_avx512(lattice, xs, ys, out, n);
+	else if (__builtin_cpu_supports("avx2"))
+		noise2d_batch_avx2(lattice, xs, ys, out, n);
+	else if (__builtin_cpu_supports("sse4.1"))
+		noise2d_batch_sse41(lattice, xs, ys, out, n);
+	else
+		return 0;
+	return 1;
+}
+
+/*
+	The 3D version of simd_noise2d_batch.
+*/
+static int simd_noise3d_batch(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float const *zs, 
+	float *out, 
+	size_t n)
+{
+	if (!simd_supported(lattice))
+		return 0;
+
+	if (__builtin_cpu_supports("avx512f"))
+		noise3d_batch_avx512(lattice, xs, ys, zs, out, n);
+	else if (__builtin_cpu_supports("avx2"))
+		noise3d_batch_avx2(lattice, xs, ys, zs, out, n);
+	else if (__builtin_cpu_supports("sse4.1"))
+		noise3d_batch_sse41(lattice, xs, ys, zs, out, n);
+	else
+		return 0;
+	return 1;
+}
+#endif
+
+float ln_lattice_noise2d(ln_lattice lattice, float x, float y)
+{
+	if (lattice == NULL || lattice->dimensions != 2)
+		return INFINITY;
+	return noise2d_sample(lattice, x, y);
+}
+
+/*
+	Samples n points of a validated 2D lattice, with the vector kernels when 
+	possible.
+*/
+static void noise2d_sample_batch(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float *out, 
+	size_t n)
+{
+#ifdef LN_SIMD_X86
+	if (simd_noise2d_batch(lattice, xs, ys, out, n))
+		return;
+#endif
+
+	STORAGE_CALL(lattice, noise2d_sample_loop, (lattice, xs, ys, out, n))
+}
 
-/* rng_func_def that uses the stdlib RNG. */
-static float default_rng_func(void *state)
+int ln_lattice_noise2d_batch(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float *out, 
+	size_t n)
 {
-	return (float) rand() / (float) RAND_MAX;
+	if (lattice == NULL || lattice->dimensions != 2 
+		|| xs == NULL || ys == NULL || out == NULL)
+		return 0;
+
+	noise2d_sample_batch(lattice, xs, ys, out, n);
+	return 1;
 }
 
-static ln_rng_func_def default_rng()
+int ln_lattice_noise2d_span(
+	ln_lattice lattice, 
+	float x0, 
+	float dx, 
+	float y, 
+	size_t count, 
+	float *out)
 {
-	struct ln_rng_func_def_s def = {0};
+	if (lattice == NULL || lattice->dimensions != 2 || out == NULL)
+		return 0;
 
-	time_t t = time(NULL);
+	float r2;
+	ptrdiff_t yi[4];
+	footprint(lattice, split_coord(lattice, y, &r2), 1, yi);
 
-	def.func = &default_rng_func;
-	def.seed = (unsigned long) t * 241;
-	def.state = NULL;
+	/* The four lattice rows under the span, yi, never change. */
 
-	srand(def.seed);
+	/*
+		Note that this is a different evaluation order than ln_lattice_noise2d
+		uses, so the results can differ from it in the last bits.
+	*/
+	STORAGE_CALL(lattice, noise2d_span, (lattice, x0, dx, yi, r2, count, out))
 
-	return def;
+	return 1;
 }
 
-inline float clamp01(float v)
+/*
+	Adds the octave value v with amplitude a to a fractal sum, the way mode 
+	does it. This is the one place the modes are defined, ln_fsum_max_value 
+	excepted.
+*/
+inline static float fsum_term(ln_fsum_mode mode, float sum, float a, float v)
 {
-	if (v < 0.0f)
-		return 0.0f;
-	if (v > 1.0f)
-		return 1.0f;
-	return v;
+	switch (mode)
+	{
+		case LN_FSUM_TURBULENCE:
+			return sum + a * fabsf(2.0f * v - 1.0f);
+		case LN_FSUM_RIDGED:
+		{
+			float r = 1.0f - fabsf(2.0f * v - 1.0f);
+			return sum + a * (r * r);
+		}
+		case LN_FSUM_HETERO_TERRAIN:
+			return sum + a * v * sum;
+		default:
+			return sum + a * v;
+	}
 }
 
-ln_lattice ln_lattice_new(
-	unsigned int dimensions, 
-	unsigned int dim_length,
-	ln_rng_func_def *rng_func)
+/*
+	fsum_term for n sums at once. The mode is switched on outside the loops 
+	so that they vectorize.
+*/
+static void fsum_accumulate(
+	ln_fsum_mode mode, 
+	float *sum, 
+	float const *v, 
+	float a, 
+	size_t n)
 {
-	if (dimensions < 1 || dim_length < 1)
-		return NULL;
+	switch (mode)
+	{
+		case LN_FSUM_TURBULENCE:
+			for (size_t i = 0; i < n; ++i)
+				sum[i] = fsum_term(LN_FSUM_TURBULENCE, sum[i], a, v[i]);
+			break;
+		case LN_FSUM_RIDGED:
+			for (size_t i = 0; i < n; ++i)
+				sum[i] = fsum_term(LN_FSUM_RIDGED, sum[i], a, v[i]);
+			break;
+		case LN_FSUM_HETERO_TERRAIN:
+			for (size_t i = 0; i < n; ++i)
+				sum[i] = fsum_term(LN_FSUM_HETERO_TERRAIN, sum[i], a, v[i]);
+			break;
+		default:
+			for (size_t i = 0; i < n; ++i)
+				sum[i] = fsum_term(LN_FSUM_FBM, sum[i], a, v[i]);
+			break;
+	}
+}
 
-	/* We simply use a bigger datatype here and avoid lengthy overflow
-	   checks. */
-	unsigned long long size = 1;
-	for (unsigned int i = 0; i < dimensions; i++)
+/*
+	Samples a validated 2D lattice at every (gx[i], gy[j]) of a w by h grid. 
+	The value is written to out[j * stride + i], or with accumulate set, it 
+	is added to it as an octave of amplitude a of a mode fractal sum.
+*/
+static int noise2d_grid_pass(
+	ln_lattice lattice, 
+	float const *gx, 
+	float const *gy, 
+	size_t w, 
+	size_t h, 
+	float *out, 
+	size_t stride, 
+	float a, 
+	ln_fsum_mode mode, 
+	int accumulate)
+{
+	/*
+		Scratch space:
+			cols	the four lattice columns under each output column.
+			r1		the fractional x-position of each output column.
+			rows	four intermediate rows, lattice rows interpolated along x 
+					at every output column.
+			vals	an output row to add to out.
+	*/
+	ptrdiff_t *cols = malloc(w * 4 * sizeof(ptrdiff_t));
+	float *scratch = malloc(w * 6 * sizeof(float));
+	if (cols == NULL || scratch == NULL)
 	{
-		size *= (unsigned long long) dim_length;
+		free(cols);
+		free(scratch);
+		return 0;
 	}
+	float *r1 = scratch;
+	float *rows[4] = { 
+		scratch + w, scratch + w * 2, scratch + w * 3, scratch + w * 4 };
+	float *vals = scratch + w * 5;
+	/* Which lattice row each intermediate row holds. */
+	ptrdiff_t row_index[4] = {0, 0, 0, 0};
+	int row_valid[4] = {0, 0, 0, 0};
 
-	if (size > UINT_MAX)
-		return NULL;
+	for (size_t i = 0; i < w; ++i)
+	{
+		footprint(lattice, split_coord(lattice, gx[i], r1 + i), 0, cols + i * 4);
+	}
 
-	unsigned int ulsize = (unsigned int) size;
+	for (size_t j = 0; j < h; ++j)
+	{
+		float r2;
+		ptrdiff_t needed[4];
+		footprint(lattice, split_coord(lattice, gy[j], &r2), 1, needed);
+		float const *taps[4];
 
-	/* Set up the Lattice. */
-	ln_lattice lattice = malloc(sizeof(struct ln_lattice_s));
-	if (lattice == NULL)
-		return NULL;
+		/*
+			Interpolate the lattice rows we need along x, unless one of the 
+			intermediate rows already holds them. Moving down the image only 
+			ever brings in one new lattice row at a time, so most output rows 
+			reuse all four.
+		*/
+		for (unsigned int k = 0; k < 4; ++k)
+		{
+			unsigned int slot = 4;
+			for (unsigned int s = 0; s < 4; ++s)
+			{
+				if (row_valid[s] && row_index[s] == needed[k])
+					slot = s;
+			}
 
-	lattice->values = malloc(ulsize * sizeof(float));
-	if (lattice->values == NULL)
-		goto die_clean;
-	
-	/* only used if rng_func == NULL */
-	ln_rng_func_def default_rng_def = {0};
-	if (!rng_func)
-	{
-		default_rng_def = default_rng();
-		rng_func = &default_rng_def;
-	}
+			if (slot == 4)
+			{
+				/* Evict a row this output row doesn't use. */
+				for (unsigned int s = 0; s < 4 && slot == 4; ++s)
+				{
+					int used = 0;
+					for (unsigned int q = 0; q < 4; ++q)
+						used |= row_valid[s] && row_index[s] == needed[q];
+					if (!used)
+						slot = s;
+				}
 
-	lattice->dimensions = dimensions;
-	lattice->dim_length = dim_length;
-	lattice->size = ulsize;
-	lattice->seed = rng_func->seed;
+				STORAGE_CALL(lattice, noise2d_grid_row, 
+					(lattice, needed[k], cols, r1, rows[slot], w))
+				row_index[slot] = needed[k];
+				row_valid[slot] = 1;
+			}
 
-	/* Initialize the values. */
+			taps[k] = rows[slot];
+		}
 
-	for (unsigned int i = 0; i < ulsize; ++i)
-	{
-		float v = rng_func->func(rng_func->state);
-		lattice->values[i] = clamp01(v);
+		/* The same final step as in ln_lattice_noise2d. */
+		float *dst = out + j * stride;
+		if (accumulate)
+		{
+			for (size_t i = 0; i < w; ++i)
+				vals[i] = clamp01(cubic(taps[0][i], taps[1][i], taps[2][i], taps[3][i], r2));
+			fsum_accumulate(mode, dst, vals, a, w);
+		}
+		else
+		{
+			for (size_t i = 0; i < w; ++i)
+				dst[i] = clamp01(cubic(taps[0][i], taps[1][i], taps[2][i], taps[3][i], r2));
+		}
 	}
-	
-	return lattice;
-	
-die_clean:
-	free(lattice->values);
-	free(lattice);
 
-	lattice = NULL;
+	free(cols);
+	free(scratch);
 
-	return lattice;
+	return 1;
 }
 
-void ln_lattice_free(ln_lattice lattice)
+int ln_lattice_noise2d_grid(
+	ln_lattice lattice, 
+	float x0, 
+	float y0, 
+	float dx, 
+	float dy, 
+	size_t w, 
+	size_t h, 
+	float *out, 
+	size_t stride)
 {
-	free(lattice->values);
-	free(lattice);
+	if (lattice == NULL || lattice->dimensions != 2 || out == NULL || stride < w)
+		return 0;
+	if (w == 0 || h == 0)
+		return 1;
+
+	float *coords = malloc((w + h) * sizeof(float));
+	if (coords == NULL)
+		return 0;
+	float *gx = coords;
+	float *gy = coords + w;
+	for (size_t i = 0; i < w; ++i)
+		gx[i] = x0 + (float) i * dx;
+	for (size_t j = 0; j < h; ++j)
+		gy[j] = y0 + (float) j * dy;
+
+	int ok = noise2d_grid_pass(lattice, gx, gy, w, h, out, stride, 1.0f, LN_FSUM_FBM, 0);
+	free(coords);
+	return ok;
 }
 
-float ln_lattice_value1(
-	ln_lattice lattice, 
-	unsigned int x)
+float ln_lattice_noise3d(ln_lattice lattice, float x, float y, float z)
 {
-	if (lattice == NULL || lattice->dimensions != 1 || x > lattice->size - 1)
+	if (lattice == NULL || lattice->dimensions != 3)
 		return INFINITY;
-	return lattice->values[x];
+	return noise3d_sample(lattice, x, y, z);
 }
 
-float ln_lattice_value2(
+int ln_lattice_noise3d_batch(
 	ln_lattice lattice, 
-	unsigned int x,
-	unsigned int y)
+	float const *xs, 
+	float const *ys, 
+	float const *zs, 
+	float *out, 
+	size_t n)
 {
-	if (lattice == NULL 
-		|| lattice->dimensions != 2 
-		|| x >= lattice->dim_length
-		|| y >= lattice->dim_length)
-		return INFINITY;
-	return lattice->values[(y * lattice->dim_length) + x];
+	if (lattice == NULL || lattice->dimensions != 3 
+		|| xs == NULL || ys == NULL || zs == NULL || out == NULL)
+		return 0;
+
+#ifdef LN_SIMD_X86
+	if (simd_noise3d_batch(lattice, xs, ys, zs, out, n))
+		return 1;
+#endif
+
+	STORAGE_CALL(lattice, noise3d_sample_loop, (lattice, xs, ys, zs, out, n))
+
+	return 1;
 }
 
-float ln_lattice_value3(
-	ln_lattice lattice, 
-	unsigned int x,
-	unsigned int y,
-	unsigned int z)
+float ln_lattice_noise4d(ln_lattice lattice, float x, float y, float z, float w)
 {
-	if (lattice == NULL 
-		|| lattice->dimensions != 2 
-		|| x >= lattice->dim_length
-		|| y >= lattice->dim_length
-		|| z >= lattice->dim_length)
+	if (lattice == NULL || lattice->dimensions != 4)
 		return INFINITY;
-	return lattice->values[
-		  (z * lattice->dim_length * lattice->dim_length) 
-		+ (y * lattice->dim_length) 
-		+ x];
+	return noise4d_sample(lattice, x, y, z, w);
 }
 
-float ln_lattice_value4(
+float ln_lattice_noise4d_smooth(
 	ln_lattice lattice, 
-	unsigned int x,
-	unsigned int y,
-	unsigned int z,
-	unsigned int w)
+	float x, 
+	float y, 
+	float z, 
+	float w)
 {
-	if (lattice == NULL 
-		|| lattice->dimensions != 2 
-		|| x >= lattice->dim_length
-		|| y >= lattice->dim_length
-		|| z >= lattice->dim_length
-		|| w >= lattice->dim_length)
+	if (lattice == NULL || lattice->dimensions != 4)
 		return INFINITY;
-	return lattice->values[
-		  (w * lattice->dim_length * lattice->dim_length * lattice->dim_length) 
-		+ (z * lattice->dim_length * lattice->dim_length) 
-		+ (y * lattice->dim_length) 
-		+ x];
+	return noise4d_smooth_sample(lattice, x, y, z, w);
 }
 
-/*
-	Simply takes the value modulo dim_length to ensure we are always inside the
-	lattice.
-*/
-#define WRAP(offset) ((offset) % lattice->dim_length)
-
-float ln_lattice_noise1d(ln_lattice lattice, float x)
+int ln_lattice_noise4d_batch(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float const *zs, 
+	float const *ws, 
+	float *out, 
+	size_t n)
 {
-	/*
-		Map x into the lattice space.
-	*/
-	x = fmodf(fabs(x), (float) lattice->dim_length);
-	float fix; 
-	/*
-		We rip out the fractional part, we will use this for interpolation for 
-		x-coordinates between lattice points.
-		
-		We use the integer part (fix) to actually get the discrete lattice 
-		values.
-	*/
-	float r = modff(x, &fix);
-	
-	/*
-		lattice->dim_length is unsigned int, and we have already computed x 
-		module dim_length, so fix will always fit into an unsigned int.
-	*/
-	unsigned int uix = (unsigned int) fix;
+	if (lattice == NULL || lattice->dimensions != 4 
+		|| xs == NULL || ys == NULL || zs == NULL || ws == NULL || out == NULL)
+		return 0;
 
-	float p0 = ln_lattice_value1(lattice,  WRAP(uix - 1));
-	float p1 = ln_lattice_value1(lattice,  WRAP(uix));
-	float p2 = ln_lattice_value1(lattice,  WRAP(uix + 1));
-	float p3 = ln_lattice_value1(lattice,  WRAP(uix + 2));
+	STORAGE_CALL(lattice, noise4d_sample_loop, (lattice, xs, ys, zs, ws, out, n))
 
-	return catmull_rom(p0, p1, p2, p3, r);
+	return 1;
 }
 
-float ln_lattice_noise2d(ln_lattice lattice, float x, float y)
+int ln_lattice_noise4d_smooth_batch(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float const *zs, 
+	float const *ws, 
+	float *out, 
+	size_t n)
 {
-	/*
-		See the 1D-version for a description of this. 
-		We just do the same thing twice.
-	*/
-	x = fmodf(fabs(x), (float) lattice->dim_length);
-	y = fmodf(fabs(y), (float) lattice->dim_length);
-	float fix; float fiy;
-	float r1 = modff(x, &fix);
-	float r2 = modff(y, &fiy);
-
-	unsigned int uix = (unsigned int) fix;
-	unsigned int uiy = (unsigned int) fiy;
-	
-	/*
-		Compute 4 interpolated values across x for each y-index.
-		Then interpolate along y.
-	*/	
-	float v[4] = {0, 0, 0, 0};
-
-	size_t curr = 0;
-	unsigned int y_base = WRAP(uiy - 1);
-	for (unsigned int i = 0; i < 4; ++i)
-	{
-		float p0 = ln_lattice_value2(lattice, WRAP(uix - 1),  y_base);
-		float p1 = ln_lattice_value2(lattice, WRAP(uix),      y_base);
-		float p2 = ln_lattice_value2(lattice, WRAP(uix + 1),  y_base);
-		float p3 = ln_lattice_value2(lattice, WRAP(uix + 2),  y_base);
-		
-#ifdef LN_DEFAULT_HERMITE_INTERPOLATION
-		/* 
-			We use the slope between p0, p2 and p1, p3 here as tangents.
-			It gives a reasonably smooth "continous" interpolation.
-		*/
-		v[curr++] = hermite01(p1, (p2 - p0) / 3.0f, p2, (p3 - p1) / 3.0f, r1);
-#else
-		/* 
-			For Catmull-Rom we just use the samples as four points.
-			
-			The Catmull-Rom interpolation is guaranteed to go through the 
-			points.
-		*/
-		v[curr++] = catmull_rom(p0, p1, p2, p3, r1);
-#endif
-		y_base = WRAP(y_base + 1);
-	}
+	if (lattice == NULL || lattice->dimensions != 4 
+		|| xs == NULL || ys == NULL || zs == NULL || ws == NULL || out == NULL)
+		return 0;
 
-	/*
-		We can actually wind up with values outside [0.0, 1.0] here so we clamp 
-		the value and hope for the best.
-	*/
-	float r = 0.0f;
-#ifdef LN_DEFAULT_HERMITE_INTERPOLATION
-	r = clamp01(hermite01(v[1], (v[2] - v[0]) / 3.0f, v[2], (v[3] - v[1]) / 3.0f, r2));
-#else
-	r = clamp01(catmull_rom(v[0], v[1], v[2], v[3], r2));
-#endif
-	return r;
+	STORAGE_CALL(lattice, noise4d_smooth_sample_loop, (lattice, xs, ys, zs, ws, out, n))
+
+	return 1;
 }
 
 ln_fsum_options ln_default_fsum_options()
@@ -311,20 +2406,152 @@ ln_fsum_options ln_default_fsum_options()
 	options.amplitude_ratio = 0.5f;
 	options.frequency_ratio = 2.0f;
 	options.offset = 0.0f;
+	options.octave_seed = 0;
+	options.mode = LN_FSUM_FBM;
+	options.tolerance = 0.0f;
+	options.sample_spacing = 0.0f;
 	return options;
 }
 
+static int fsum_options_valid(ln_fsum_options const *opt)
+{
+	return opt != NULL && opt->n >= 1 
+		&& opt->mode >= LN_FSUM_FBM && opt->mode <= LN_FSUM_HETERO_TERRAIN;
+}
+
+/*
+	The largest value a sum that is at most v after the first i octaves can 
+	have after octave i, which has amplitude a. See ln_fsum_max_value.
+*/
+inline static float fsum_max_step(
+	ln_fsum_options const *opt, 
+	float v, 
+	float a, 
+	unsigned int i)
+{
+	if (opt->mode == LN_FSUM_HETERO_TERRAIN && i > 0)
+		return v + a * v;
+	return v + a;
+}
+
+/*
+	The largest value the first m octaves of a sum can add up to.
+*/
+static float fsum_partial_max(ln_fsum_options const *opt, unsigned int m)
+{
+	float v = opt->offset;
+	float a = 1.0f;
+	for (unsigned int i = 0; i < m; ++i)
+	{
+		v = fsum_max_step(opt, v, a, i);
+		a *= opt->amplitude_ratio;
+	}
+	return v;
+}
+
+/*
+	Octaves with more than this many lattice cells per sample are above the
+	Nyquist limit: value noise changes about once per cell, so the samples 
+	need to be at most half a cell apart to follow it.
+*/
+#define FSUM_NYQUIST 0.5f
+
+/*
+	The number of octaves of a sum that are worth evaluating, at least one. 
+	Without tolerance or sample_spacing, all of them.
+*/
+static unsigned int fsum_octave_count(ln_fsum_options const *opt)
+{
+	unsigned int n = opt->n;
+	if (opt->sample_spacing > 0.0f)
+	{
+		/* Octave i has frequency_ratio ^ i lattice cells per unit. */
+		unsigned int m = 1;
+		float f = opt->frequency_ratio;
+		while (m < n && f * opt->sample_spacing <= FSUM_NYQUIST)
+		{
+			++m;
+			f *= opt->frequency_ratio;
+		}
+		n = m;
+	}
+
+	if (opt->tolerance > 0.0f)
+	{
+		/*
+			The octaves after the first m can add at most the difference 
+			between the maximum of the whole sum and of the first m octaves. 
+			Stop at the first m where that is within the tolerance.
+		*/
+		float total = fsum_partial_max(opt, n);
+		float partial = fsum_max_step(opt, opt->offset, 1.0f, 0);
+		float a = opt->amplitude_ratio;
+		unsigned int m = 1;
+		while (m < n && total - partial >= opt->tolerance)
+		{
+			partial = fsum_max_step(opt, partial, a, m);
+			a *= opt->amplitude_ratio;
+			++m;
+		}
+		n = m;
+	}
+	return n;
+}
+
+/*
+	The mode octave is added to the sum with. Heterogeneous terrain scales 
+	each term by the sum so far, so it starts out with a plain one.
+*/
+static ln_fsum_mode fsum_octave_mode(ln_fsum_options const *opt, unsigned int octave)
+{
+	if (opt->mode == LN_FSUM_HETERO_TERRAIN && octave == 0)
+		return LN_FSUM_FBM;
+	return opt->mode;
+}
+
+/*
+	Puts the offset octave adds to each coordinate in o. Without an 
+	octave_seed they are all 0. Otherwise they are hashed from the seed, 
+	octave and axis and are up to 256 lattice points, so the coordinates 
+	keep their precision in large lattices.
+*/
+static void fsum_octave_offsets(
+	ln_lattice lattice, 
+	ln_fsum_options const *opt, 
+	unsigned int octave, 
+	float *o)
+{
+	if (opt->octave_seed == 0)
+	{
+		for (unsigned int k = 0; k < lattice->dimensions; ++k)
+			o[k] = 0.0f;
+		return;
+	}
+
+	float range = lattice->dim_length < 256 ? (float) lattice->dim_length : 256.0f;
+	uint32_t key = hash32(opt->octave_seed + octave * 0x9e3779b9U);
+	for (unsigned int k = 0; k < lattice->dimensions; ++k)
+	{
+		/* 24 bits of the hash give a uniform float in [0, 1). */
+		o[k] = (float) (hash32(key ^ (k + 1)) >> 8) * (1.0f / 16777216.0f) * range;
+	}
+}
+
 #define FSUM_IMPLEMENTATION(call, dims)\
-	if (opt->n < 1 || lattice->dimensions != (dims))\
+	if (!fsum_options_valid(opt) || lattice == NULL || lattice->dimensions != (dims))\
 		return INFINITY;\
 	\
 	float result = opt->offset;\
 	\
 	float a = 1;\
 	float f = 1;\
-	for (unsigned int i = 0; i < opt->n; ++i)\
+	float o[dims] = {0};\
+	unsigned int n = fsum_octave_count(opt);\
+	for (unsigned int i = 0; i < n; ++i)\
 	{		 \
-		result += a * (call);\
+		if (opt->octave_seed != 0)\
+			fsum_octave_offsets(lattice, opt, i, o);\
+		result = fsum_term(fsum_octave_mode(opt, i), result, a, (call));\
 		a *= opt->amplitude_ratio;\
 		f *= opt->frequency_ratio;\
 	}\
@@ -333,23 +2560,205 @@ ln_fsum_options ln_default_fsum_options()
 
 float ln_lattice_fsum1d(ln_lattice lattice, float x, ln_fsum_options const *opt)
 {
-	FSUM_IMPLEMENTATION(ln_lattice_noise1d(lattice, f * x), 1)
+	FSUM_IMPLEMENTATION(noise1d_sample(lattice, f * x + o[0]), 1)
 }
 
 float ln_lattice_fsum2d(ln_lattice lattice, float x, float y, ln_fsum_options const *opt)
 {
-	FSUM_IMPLEMENTATION(ln_lattice_noise2d(lattice, f * x, f * y), 2)
+	FSUM_IMPLEMENTATION(noise2d_sample(lattice, f * x + o[0], f * y + o[1]), 2)
+}
+
+/* ln_lattice_fsum2d_batch works through the points this many at a time. */
+#define FSUM_BLOCK 256
+
+int ln_lattice_fsum2d_batch(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float *out, 
+	size_t n, 
+	ln_fsum_options const *opt)
+{
+	if (!fsum_options_valid(opt) || lattice == NULL || lattice->dimensions != 2
+		|| xs == NULL || ys == NULL || out == NULL)
+		return 0;
+
+	unsigned int octaves = fsum_octave_count(opt);
+
+	/*
+		All octaves of a block are done before moving on to the next one, so 
+		the block stays in the cache. Each octave is one call to the batch 
+		sampler on the scaled coordinates, and the sums are built up in the 
+		same order as in ln_lattice_fsum2d, so the results are identical.
+	*/
+	for (size_t first = 0; first < n; first += FSUM_BLOCK)
+	{
+		size_t count = n - first < FSUM_BLOCK ? n - first : FSUM_BLOCK;
+		float fx[FSUM_BLOCK], fy[FSUM_BLOCK], v[FSUM_BLOCK];
+		float *sum = out + first;
+
+		for (size_t i = 0; i < count; ++i)
+			sum[i] = opt->offset;
+
+		float a = 1;
+		float f = 1;
+		for (unsigned int octave = 0; octave < octaves; ++octave)
+		{
+			float o[2];
+			fsum_octave_offsets(lattice, opt, octave, o);
+			for (size_t i = 0; i < count; ++i)
+			{
+				fx[i] = f * xs[first + i] + o[0];
+				fy[i] = f * ys[first + i] + o[1];
+			}
+			noise2d_sample_batch(lattice, fx, fy, v, count);
+			fsum_accumulate(fsum_octave_mode(opt, octave), sum, v, a, count);
+
+			a *= opt->amplitude_ratio;
+			f *= opt->frequency_ratio;
+		}
+	}
+
+	return 1;
+}
+
+/*
+	Up to this many lattice rows per grid row, an octave of 
+	ln_lattice_fsum2d_grid is rendered by the grid sampler. Above it, the 
+	intermediate rows are rarely reused and the AVX2 and AVX-512 batch 
+	kernels are faster. The SSE4.1 kernel only catches up at several rows per
+	row and the scalar batch loop never does.
+*/
+#define FSUM_GRID_MAX_STEP 0.25f
+
+int ln_lattice_fsum2d_grid(
+	ln_lattice lattice, 
+	float x0, 
+	float y0, 
+	float dx, 
+	float dy, 
+	size_t w, 
+	size_t h, 
+	float *out, 
+	size_t stride, 
+	ln_fsum_options const *opt)
+{
+	if (!fsum_options_valid(opt) || lattice == NULL || lattice->dimensions != 2
+		|| out == NULL || stride < w)
+		return 0;
+	if (w == 0 || h == 0)
+		return 1;
+
+	/* 
+		The grid coordinates, the same scaled for the current octave, and a 
+		row of y coordinates and values for the batch sampler.
+	*/
+	float *coords = malloc((w * 4 + h * 2) * sizeof(float));
+	if (coords == NULL)
+		return 0;
+	float *px = coords;
+	float *py = px + w;
+	float *gx = py + h;
+	float *gy = gx + w;
+	float *row_y = gy + h;
+	float *row_v = row_y + w;
+	for (size_t i = 0; i < w; ++i)
+		px[i] = x0 + (float) i * dx;
+	for (size_t j = 0; j < h; ++j)
+		py[j] = y0 + (float) j * dy;
+
+	for (size_t j = 0; j < h; ++j)
+	{
+		for (size_t i = 0; i < w; ++i)
+			out[j * stride + i] = opt->offset;
+	}
+
+	/*
+		The grid is sampled one octave at a time and the octaves are added up 
+		in out. Each pass then only touches the lattice rows under the grid at
+		that frequency, and the grid sampler shares the interpolation between
+		the many pixels per lattice cell of the low octaves. The high octaves,
+		with several lattice cells per pixel, are sampled a row at a time with
+		the batch sampler instead. The octaves are added in the same order as 
+		in ln_lattice_fsum2d, with the coordinates scaled the same way, so the
+		results are identical.
+	*/
+	/* Without a gather kernel for the lattice, the grid sampler always wins. */
+	float max_step = INFINITY;
+#ifdef LN_SIMD_X86
+	if (simd_gather_available(lattice))
+		max_step = FSUM_GRID_MAX_STEP;
+#endif
+
+	int ok = 1;
+	float a = 1;
+	float f = 1;
+	unsigned int octaves = fsum_octave_count(opt);
+	for (unsigned int octave = 0; octave < octaves && ok; ++octave)
+	{
+		ln_fsum_mode mode = fsum_octave_mode(opt, octave);
+		float o[2];
+		fsum_octave_offsets(lattice, opt, octave, o);
+		for (size_t i = 0; i < w; ++i)
+			gx[i] = f * px[i] + o[0];
+		for (size_t j = 0; j < h; ++j)
+			gy[j] = f * py[j] + o[1];
+
+		if (f * fabsf(dy) <= max_step)
+		{
+			ok = noise2d_grid_pass(lattice, gx, gy, w, h, out, stride, a, mode, 1);
+		}
+		else
+		{
+			for (size_t j = 0; j < h; ++j)
+			{
+				float *dst = out + j * stride;
+				for (size_t i = 0; i < w; ++i)
+					row_y[i] = gy[j];
+				noise2d_sample_batch(lattice, gx, row_y, row_v, w);
+				fsum_accumulate(mode, dst, row_v, a, w);
+			}
+		}
+
+		a *= opt->amplitude_ratio;
+		f *= opt->frequency_ratio;
+	}
+
+	free(coords);
+	return ok;
 }
 
 float ln_fsum_max_value(ln_fsum_options const *opt)
 {
-	if (opt->n < 1)
+	if (!fsum_options_valid(opt))
 		return INFINITY;
-	float v = opt->offset;
-	/*
-		In the algorithm above, we always add one term with 1.0f amplitude.
+
+	float r = opt->amplitude_ratio;
+	if (opt->mode == LN_FSUM_HETERO_TERRAIN)
+	{
+		/*
+			Every term after the first is its amplitude times the sample times 
+			the sum so far. As long as the sum stays positive, it is largest 
+			when every sample is 1.0f and every term grows the sum by a factor 
+			of 1 + r^i.
+		*/
+		float v = opt->offset + 1.0f;
+		float a = 1.0f;
+		for (unsigned int i = 1; i < opt->n; ++i)
+		{
+			a *= r;
+			v += a * v;
+		}
+		return v;
+	}
+
+	/* 
+		For the other modes each term is at most 1.0f times its amplitude. The 
+		octave values of turbulence and ridged noise are folded back into 
+		[0.0, 1.0], turbulence reaching 1.0f where the noise is 0.0f or 1.0f 
+		and ridged noise where it is 0.5f.
 	*/
-	v += 1.0f;
+	float v;
 	/* 
 		The maximum posssible value the fractal sum methods would output is the 
 		one where each call to ln_lattice_noise* returns a 1.0f.
@@ -371,12 +2780,11 @@ float ln_fsum_max_value(ln_fsum_options const *opt)
 		
 		If amplitude_ratio is 1.0 the result is just 1.0 * opt->n.
 	*/
-	float r = opt->amplitude_ratio;
 	if (r != 1.0f)
 		v = (1.0f - powf(r, opt->n)) / (1.0f - r);
 	else
 		v = opt->n; 
-	return v;
+	return opt->offset + v;
 }
 
 inline static float catmull_rom(
@@ -399,6 +2807,28 @@ inline static float catmull_rom(
 	return a * x3 + b * x2 + c * x + d;
 }
 
+/*
+	The coefficients (a, b, c, d) of the cubic a*x^3 + b*x^2 + c*x + d that the 
+	default interpolation (Catmull-Rom or Hermite) passes through p1 and p2 with.
+*/
+inline static void cubic_coefficients(
+	float p0, 
+	float p1, 
+	float p2, 
+	float p3, 
+	float coeffs[4])
+{
+#ifdef LN_DEFAULT_HERMITE_INTERPOLATION
+	float m0 = (p2 - p0) / 3.0f, m1 = (p3 - p1) / 3.0f;
+#else
+	float m0 = (p2 - p0) / 2, m1 = (p3 - p1) / 2;
+#endif
+	coeffs[0] = (2 * p1)  - (2 * p2) + m0 + m1;
+	coeffs[1] = (-3 * p1) + (3 * p2) - (2 * m0) - m1;
+	coeffs[2] = m0;
+	coeffs[3] = p1;
+}
+
 inline static float hermite01(
 	float p0,
 	float m0,
@@ -0,0 +1,358 @@
+/*
+	Copyright (c) 2012, Simon Otter
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright notice, this
+	   list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright notice,
+	   this list of conditions and the following disclaimer in the documentation
+	   and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+	ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+	WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+	ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+	(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+	LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+	ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+	SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+	The views and conclusions contained in the software and documentation are those
+	of the authors and should not be interpreted as representing official policies,
+	either expressed or implied, of the FreeBSD Project.
+*/
+
+
+/** \file
+
+	latticenoise_sampler.h
+
+	Internal to latticenoise.c, this is NOT a public header.
+
+	The scalar samplers, written once against a tap function. latticenoise.c 
+	includes this file once per way of storing the lattice values, so every
+	sampler reads its taps without having to look at how they are stored. 
+	Which instantiation runs is decided once per call, before the taps.
+
+	Expected macros:
+		LNS(name)			Decorates a function name with the storage, 
+							LNS(tap)(lattice, offset) reads the value at 
+							offset.
+*/
+
+/*
+	The actual 1D sampler, like noise2d_sample it does no validation.
+*/
+inline static float LNS(noise1d_sample)(ln_lattice lattice, float x)
+{
+	/*
+		Map x into the lattice space. 
+
+		We rip out the fractional part, we will use this for interpolation for 
+		x-coordinates between lattice points. The integer part is used to 
+		actually get the discrete lattice values.
+	*/
+	float r;
+	ptrdiff_t xi[4];
+	footprint(lattice, split_coord(lattice, x, &r), 0, xi);
+
+	float p0 = LNS(tap)(lattice, xi[0]);
+	float p1 = LNS(tap)(lattice, xi[1]);
+	float p2 = LNS(tap)(lattice, xi[2]);
+	float p3 = LNS(tap)(lattice, xi[3]);
+
+	return catmull_rom(p0, p1, p2, p3, r);
+}
+
+/*
+	The actual 2D sampler. 
+
+	It performs no validation of the lattice, callers must make sure it is a 
+	valid 2D lattice first.
+*/
+inline static float LNS(noise2d_sample)(ln_lattice lattice, float x, float y)
+{
+	/*
+		See the 1D-version for a description of this. 
+		We just do the same thing twice.
+	*/
+	float r1, r2;
+	ptrdiff_t xi[4], yi[4];
+	footprint(lattice, split_coord(lattice, x, &r1), 0, xi);
+	footprint(lattice, split_coord(lattice, y, &r2), 1, yi);
+	
+	/*
+		Compute 4 interpolated values across x for each y-index.
+		Then interpolate along y.
+	*/	
+	float v[4] = {0, 0, 0, 0};
+
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		float p0 = LNS(tap)(lattice, yi[i] + xi[0]);
+		float p1 = LNS(tap)(lattice, yi[i] + xi[1]);
+		float p2 = LNS(tap)(lattice, yi[i] + xi[2]);
+		float p3 = LNS(tap)(lattice, yi[i] + xi[3]);
+		
+		v[i] = cubic(p0, p1, p2, p3, r1);
+	}
+
+	/*
+		We can actually wind up with values outside [0.0, 1.0] here so we clamp 
+		the value and hope for the best.
+	*/
+	float r = clamp01(cubic(v[0], v[1], v[2], v[3], r2));
+	return r;
+}
+
+/*
+	The actual 3D sampler, like noise2d_sample it does no validation.
+
+	A tricubic interpolation over the 4x4x4 lattice points around the cell. 
+	It is separable, so instead of weighting all 64 points we reduce along x 
+	first, giving 16 values, then along y giving 4 and finally along z. That 
+	is 21 cubics in total, and as the lattice has an apron each group of 4 
+	taps along x is 4 consecutive values, or up to two runs of them in a 
+	bricked lattice.
+*/
+inline static float LNS(noise3d_sample)(ln_lattice lattice, float x, float y, float z)
+{
+	float r1, r2, r3;
+	ptrdiff_t xi[4], yi[4], zi[4];
+	footprint(lattice, split_coord(lattice, x, &r1), 0, xi);
+	footprint(lattice, split_coord(lattice, y, &r2), 1, yi);
+	footprint(lattice, split_coord(lattice, z, &r3), 2, zi);
+
+	float v[4];
+	for (unsigned int k = 0; k < 4; ++k)
+	{
+		float u[4];
+		for (unsigned int j = 0; j < 4; ++j)
+		{
+			ptrdiff_t row = zi[k] + yi[j];
+			u[j] = cubic(
+				LNS(tap)(lattice, row + xi[0]), LNS(tap)(lattice, row + xi[1]), 
+				LNS(tap)(lattice, row + xi[2]), LNS(tap)(lattice, row + xi[3]), 
+				r1);
+		}
+		v[k] = cubic(u[0], u[1], u[2], u[3], r2);
+	}
+
+	return clamp01(cubic(v[0], v[1], v[2], v[3], r3));
+}
+
+/*
+	Quadricubic interpolation: 256 taps, reduced separably to 64, 16, 4 and 
+	finally 1 value, so 85 cubics per sample. Like the others it does no 
+	validation.
+*/
+inline static float LNS(noise4d_sample)(
+	ln_lattice lattice, 
+	float x, float y, float z, float w)
+{
+	float r[4];
+	ptrdiff_t off[4][4];
+	footprint4(lattice, x, y, z, w, r, off);
+
+	float vw[4];
+	for (unsigned int l = 0; l < 4; ++l)
+	{
+		float vz[4];
+		for (unsigned int k = 0; k < 4; ++k)
+		{
+			float vy[4];
+			for (unsigned int j = 0; j < 4; ++j)
+			{
+				ptrdiff_t row = off[3][l] + off[2][k] + off[1][j];
+				vy[j] = cubic(
+					LNS(tap)(lattice, row + off[0][0]), LNS(tap)(lattice, row + off[0][1]), 
+					LNS(tap)(lattice, row + off[0][2]), LNS(tap)(lattice, row + off[0][3]), 
+					r[0]);
+			}
+			vz[k] = cubic(vy[0], vy[1], vy[2], vy[3], r[1]);
+		}
+		vw[l] = cubic(vz[0], vz[1], vz[2], vz[3], r[2]);
+	}
+
+	return clamp01(cubic(vw[0], vw[1], vw[2], vw[3], r[3]));
+}
+
+/*
+	Quadrilinear interpolation with smoothstep weights: 16 taps, the two 
+	closest lattice points along each axis, reduced with 15 lerps. The 
+	smoothstep makes the derivative zero at the lattice points, which hides 
+	the grid reasonably well at a fraction of the cost of the cubic.
+*/
+inline static float LNS(noise4d_smooth_sample)(
+	ln_lattice lattice, 
+	float x, float y, float z, float w)
+{
+	float r[4];
+	ptrdiff_t off[4][4];
+	footprint4(lattice, x, y, z, w, r, off);
+
+	float s[4];
+	for (unsigned int a = 0; a < 4; ++a)
+		s[a] = r[a] * r[a] * (3.0f - 2.0f * r[a]);
+
+	/* The interpolation needs the points at index and index + 1. */
+	float vw[2];
+	for (unsigned int l = 0; l < 2; ++l)
+	{
+		float vz[2];
+		for (unsigned int k = 0; k < 2; ++k)
+		{
+			float vy[2];
+			for (unsigned int j = 0; j < 2; ++j)
+			{
+				ptrdiff_t row = off[3][l + 1] + off[2][k + 1] + off[1][j + 1];
+				vy[j] = lerp(
+					LNS(tap)(lattice, row + off[0][1]), LNS(tap)(lattice, row + off[0][2]), 
+					s[0]);
+			}
+			vz[k] = lerp(vy[0], vy[1], s[1]);
+		}
+		vw[l] = lerp(vz[0], vz[1], s[2]);
+	}
+
+	return lerp(vw[0], vw[1], s[3]);
+}
+
+/*
+	The scalar batch loops. The lattice has been validated once for the whole 
+	batch, what remains is a plain loop over the points that the compiler is 
+	free to inline and unroll.
+*/
+static void LNS(noise2d_sample_loop)(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float *out, 
+	size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = LNS(noise2d_sample)(lattice, xs[i], ys[i]);
+}
+
+static void LNS(noise3d_sample_loop)(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float const *zs, 
+	float *out, 
+	size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = LNS(noise3d_sample)(lattice, xs[i], ys[i], zs[i]);
+}
+
+static void LNS(noise4d_sample_loop)(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float const *zs, 
+	float const *ws, 
+	float *out, 
+	size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = LNS(noise4d_sample)(lattice, xs[i], ys[i], zs[i], ws[i]);
+}
+
+static void LNS(noise4d_smooth_sample_loop)(
+	ln_lattice lattice, 
+	float const *xs, 
+	float const *ys, 
+	float const *zs, 
+	float const *ws, 
+	float *out, 
+	size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = LNS(noise4d_smooth_sample)(lattice, xs[i], ys[i], zs[i], ws[i]);
+}
+
+/*
+	The body of ln_lattice_noise2d_span, once the lattice rows yi under the 
+	span and the fractional y-position r2 are known.
+
+	Because the interpolation is separable we can interpolate along y first. 
+	That gives four column values per lattice cell, which turn into the 
+	coefficients of one cubic in x shared by every pixel in the cell.
+*/
+static void LNS(noise2d_span)(
+	ln_lattice lattice, 
+	float x0, 
+	float dx, 
+	ptrdiff_t const yi[4], 
+	float r2, 
+	size_t count, 
+	float *out)
+{
+	float coeffs[4] = {0, 0, 0, 0};
+	/* 
+		The floored coordinate of the cell we have coefficients for. NAN never 
+		compares equal, so the first pixel always computes them.
+	*/
+	float cell_key = NAN;
+	for (size_t i = 0; i < count; ++i)
+	{
+		float x = fabs(x0 + (float) i * dx);
+		float key = floorf(x);
+		/* 
+			x - floor(x) is exact and equals what modff would give us after the
+			fmodf reduction.
+		*/
+		float r1 = x - key;
+
+		if (key != cell_key)
+		{
+			cell_key = key;
+			float unused;
+			ptrdiff_t cols[4];
+			footprint(lattice, split_coord(lattice, key, &unused), 0, cols);
+
+			float c[4];
+			for (unsigned int k = 0; k < 4; ++k)
+			{
+				float cy[4];
+				cubic_coefficients(
+					LNS(tap)(lattice, yi[0] + cols[k]), LNS(tap)(lattice, yi[1] + cols[k]), 
+					LNS(tap)(lattice, yi[2] + cols[k]), LNS(tap)(lattice, yi[3] + cols[k]), 
+					cy);
+				c[k] = ((cy[0] * r2 + cy[1]) * r2 + cy[2]) * r2 + cy[3];
+			}
+			cubic_coefficients(c[0], c[1], c[2], c[3], coeffs);
+		}
+
+		out[i] = clamp01(((coeffs[0] * r1 + coeffs[1]) * r1 + coeffs[2]) * r1 + coeffs[3]);
+	}
+}
+
+/*
+	Interpolates the lattice row at offset base along x, at the w output 
+	columns of the grid sampler. cols holds the four lattice columns under 
+	each output column and r1 its fractional x-position.
+*/
+static void LNS(noise2d_grid_row)(
+	ln_lattice lattice, 
+	ptrdiff_t base, 
+	ptrdiff_t const *cols, 
+	float const *r1, 
+	float *row, 
+	size_t w)
+{
+	for (size_t i = 0; i < w; ++i)
+	{
+		ptrdiff_t const *c = cols + i * 4;
+		row[i] = cubic(
+			LNS(tap)(lattice, base + c[0]), LNS(tap)(lattice, base + c[1]), 
+			LNS(tap)(lattice, base + c[2]), LNS(tap)(lattice, base + c[3]), 
+			r1[i]);
+	}
+}
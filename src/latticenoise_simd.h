@@ -0,0 +1,410 @@
+/*
+	Copyright (c) 2012, Simon Otter
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright notice, this
+	   list of conditions and the following disclaimer.
+	2. Redistributions in binary form must reproduce the above copyright notice,
+	   this list of conditions and the following disclaimer in the documentation
+	   and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+	ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+	WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+	ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+	(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+	LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+	ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+	SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+	The views and conclusions contained in the software and documentation are those
+	of the authors and should not be interpreted as representing official policies,
+	either expressed or implied, of the FreeBSD Project.
+*/
+
+/** \file
+
+	latticenoise_simd.h
+
+	Internal to latticenoise.c, this is NOT a public header.
+
+	The SIMD sampling kernels, written once against a small set of vector
+	macros. latticenoise.c defines the macros for one instruction set and
+	includes this file, once per instruction set.
+
+	The kernels perform the exact same floating point operations, in the same
+	order, as the scalar samplers so the results are bit-identical no matter
+	which kernel ends up running.
+
+	Expected macros:
+		LNV(name)			Decorates a function name with the instruction set.
+		LNV_TARGET			Function attribute enabling the instruction set.
+		LNV_W				Number of lanes.
+		VF, VI, VM			Float vector, int32 vector and comparison mask types.
+		VF_LOAD(p)			Unaligned load of LNV_W floats.
+		VF_STORE(p, v)		Unaligned store of LNV_W floats.
+		VF_SET1(f)			Broadcast.
+		VF_ADD, VF_SUB, VF_MUL, VF_DIV, VF_MIN, VF_MAX
+							Lane-wise arithmetic. VF_MIN and VF_MAX must return
+							the second operand if either is a NaN.
+		VF_ABS(v)			Clears the sign bit.
+		VF_FLOOR(v)			Rounds towards negative infinity.
+		VF_LT(a, b)			a < b, false for NaNs.
+		VF_ADD_IF(m, a, b)	m ? a + b : a
+		VM_AND(a, b)		Mask intersection.
+		VM_ALL(m)			Nonzero if every lane of m is set.
+		VF_TO_VI(v)			Truncating conversion to int32.
+		VI_ADD, VI_MUL, VI_AND
+							Lane-wise int32 arithmetic (low 32 bits for VI_MUL.)
+		VI_SET1(i)			Broadcast.
+		VI_SLL(v, n)		Shifts every lane left by the constant n.
+		VI_TO_VF(v)			Converts int32 to float.
+		VI_AS_VF(v)			Reinterprets the bits as floats.
+		VF_GATHER(p, idx)	Loads p[idx[k]] into lane k.
+		VI_GATHER(p, idx, scale)
+							Loads the 4 bytes at (char *) p + idx[k] * scale into
+							lane k, scale is a constant 1, 2 or 4.
+*/
+
+/*
+	Vectorized catmull_rom, same expression tree as the scalar version.
+*/
+LNV_TARGET static inline VF LNV(catmull_rom)(VF p0, VF p1, VF p2, VF p3, VF x)
+{
+	VF half = VF_SET1(0.5f);
+	VF two = VF_SET1(2.0f);
+	VF three = VF_SET1(3.0f);
+
+	VF f0 = p1, f1 = p2;
+	VF fd0 = VF_MUL(VF_SUB(p2, p0), half), fd1 = VF_MUL(VF_SUB(p3, p1), half);
+
+	VF a = VF_ADD(VF_ADD(VF_SUB(VF_MUL(two, f0), VF_MUL(two, f1)), fd0), fd1);
+	VF b = VF_SUB(
+		VF_SUB(
+			VF_ADD(VF_MUL(VF_SET1(-3.0f), f0), VF_MUL(three, f1)),
+			VF_MUL(two, fd0)),
+		fd1);
+	VF c = fd0;
+	VF d = f0;
+
+	VF x2 = VF_MUL(x, x); VF x3 = VF_MUL(x2, x);
+
+	return VF_ADD(VF_ADD(VF_ADD(VF_MUL(a, x3), VF_MUL(b, x2)), VF_MUL(c, x)), d);
+}
+
+/*
+	Vectorized hermite01, same expression tree as the scalar version.
+*/
+LNV_TARGET static inline VF LNV(hermite01)(VF p0, VF m0, VF p1, VF m1, VF t)
+{
+	VF one = VF_SET1(1.0f);
+	VF two = VF_SET1(2.0f);
+	VF three = VF_SET1(3.0f);
+
+	VF h00 = VF_ADD(
+		VF_SUB(
+			VF_MUL(VF_MUL(VF_MUL(two, t), t), t),
+			VF_MUL(VF_MUL(three, t), t)),
+		one);
+	VF h10 = VF_ADD(
+		VF_SUB(VF_MUL(VF_MUL(t, t), t), VF_MUL(VF_MUL(two, t), t)),
+		t);
+	VF h01 = VF_MUL(VF_MUL(t, t), VF_SUB(three, VF_MUL(two, t)));
+	VF h11 = VF_MUL(VF_MUL(t, t), VF_SUB(t, one));
+
+	return VF_ADD(
+		VF_ADD(VF_ADD(VF_MUL(h00, p0), VF_MUL(h10, m0)), VF_MUL(h01, p1)),
+		VF_MUL(h11, m1));
+}
+
+/*
+	The cubic used along one axis, selected the same way as in the scalar
+	samplers.
+*/
+LNV_TARGET static inline VF LNV(cubic)(VF p0, VF p1, VF p2, VF p3, VF t)
+{
+#ifdef LN_DEFAULT_HERMITE_INTERPOLATION
+	VF third = VF_SET1(3.0f);
+	return LNV(hermite01)(
+		p1, VF_DIV(VF_SUB(p2, p0), third), p2, VF_DIV(VF_SUB(p3, p1), third), t);
+#else
+	return LNV(catmull_rom)(p0, p1, p2, p3, t);
+#endif
+}
+
+/*
+	Splits a coordinate into a lattice cell and the fractional position inside
+	it, like split_coord does for non power of two lattices.
+
+	For 0 <= v < SIMD_COORD_LIMIT, floor(v) is exact and so is its remainder
+	modulo m, computed here in float with a correction step for the rounding
+	of the quotient. This gives exactly the same cell and fraction as
+	fmodf + modff does.
+*/
+LNV_TARGET static inline VI LNV(split)(VF v, VF m, VF inv_m, VF *frac)
+{
+	VF fl = VF_FLOOR(v);
+	*frac = VF_SUB(v, fl);
+
+	VF q = VF_FLOOR(VF_MUL(fl, inv_m));
+	VF cell = VF_SUB(fl, VF_MUL(q, m));
+	cell = VF_ADD_IF(VF_LT(cell, VF_SET1(0.0f)), cell, m);
+	cell = VF_ADD_IF(VF_LT(VF_SUB(m, VF_SET1(1.0f)), cell), cell, VF_SUB(VF_SET1(0.0f), m));
+	return VF_TO_VI(cell);
+}
+
+/*
+	The power of two version of split, where the wrapping is just a mask of 
+	the floored coordinate.
+*/
+LNV_TARGET static inline VI LNV(split_pow2)(VF v, VI mask, VF *frac)
+{
+	VF fl = VF_FLOOR(v);
+	*frac = VF_SUB(v, fl);
+	return VI_AND(VF_TO_VI(fl), mask);
+}
+
+/*
+	Splits with whichever of the two above applies to the lattice.
+*/
+LNV_TARGET static inline VI LNV(split_coord)(
+	VF v, int pow2, VF m, VF inv_m, VI mask, VF *frac)
+{
+	if (pow2)
+		return LNV(split_pow2)(v, mask, frac);
+	return LNV(split)(v, m, inv_m, frac);
+}
+
+/*
+	Gathers the values at p + cell[k] for a lattice of the given value type,
+	p being a byte pointer to the tap relative to the cell, and dequantizes 
+	them exactly like load_value.
+
+	Quantized values are read as 4 bytes and masked, which is why the 
+	storage of quantized lattices has GATHER_SLACK bytes at the end.
+*/
+LNV_TARGET static inline VF LNV(fetch)(char const *p, VI cell, unsigned int type)
+{
+	switch (type)
+	{
+		case LN_VALUE_UINT16:
+			return VF_MUL(
+				VI_TO_VF(VI_AND(VI_GATHER(p, cell, 2), VI_SET1(0xffff))), 
+				VF_SET1(1.0f / 65535.0f));
+		case LN_VALUE_UINT8:
+			return VF_MUL(
+				VI_TO_VF(VI_AND(VI_GATHER(p, cell, 1), VI_SET1(0xff))), 
+				VF_SET1(1.0f / 255.0f));
+		case LN_VALUE_HALF:
+			return VF_MUL(
+				VI_AS_VF(VI_SLL(VI_AND(VI_GATHER(p, cell, 2), VI_SET1(0x7fff)), 13)),
+				VF_SET1(0x1p112f));
+		default:
+			return VF_GATHER((float const *) p, cell);
+	}
+}
+
+/*
+	clamp01, NaNs pass through just like in the scalar version.
+*/
+LNV_TARGET static inline VF LNV(clamp01)(VF v)
+{
+	return VF_MIN(VF_SET1(1.0f), VF_MAX(VF_SET1(0.0f), v));
+}
+
+/*
+	Vector version of ln_lattice_noise2d_batch. The caller has validated the 
+	lattice and checked that it qualifies, see simd_supported.
+
+	The lattice has an apron, so the footprint of a sample is the 4x4 block
+	starting one row and one column before its cell. We gather it with the 
+	cell's index and a fixed pointer offset per tap.
+*/
+LNV_TARGET static void LNV(noise2d_batch)(
+	ln_lattice lattice,
+	float const *xs,
+	float const *ys,
+	float *out,
+	size_t n)
+{
+	char const *storage = lattice->storage;
+	unsigned int type = lattice->value_type;
+	ptrdiff_t e = (ptrdiff_t) value_size(type);
+
+	VF m = VF_SET1((float) lattice->dim_length);
+	VF inv_m = VF_SET1(1.0f / (float) lattice->dim_length);
+	VF limit = VF_SET1(SIMD_COORD_LIMIT);
+	ptrdiff_t pitch = lattice->pitch;
+	VI stride = VI_SET1((int) pitch);
+	VI mask = VI_SET1((int) lattice->dim_length - 1);
+	int pow2 = (lattice->flags & LN_LATTICE_POW2) != 0;
+
+	size_t i = 0;
+	for (; i + LNV_W <= n; i += LNV_W)
+	{
+		VF x = VF_ABS(VF_LOAD(xs + i));
+		VF y = VF_ABS(VF_LOAD(ys + i));
+
+		/*
+			Huge coordinates and NaNs are rare enough to simply hand them to the
+			scalar sampler.
+		*/
+		if (!VM_ALL(VM_AND(VF_LT(x, limit), VF_LT(y, limit))))
+		{
+			for (size_t k = i; k < i + LNV_W; ++k)
+				out[k] = noise2d_sample(lattice, xs[k], ys[k]);
+			continue;
+		}
+
+		VF r1, r2;
+		VI cx = LNV(split_coord)(x, pow2, m, inv_m, mask, &r1);
+		VI cy = LNV(split_coord)(y, pow2, m, inv_m, mask, &r2);
+		VI cell = VI_ADD(VI_MUL(cy, stride), cx);
+
+		VF v[4];
+		for (ptrdiff_t j = 0; j < 4; ++j)
+		{
+			char const *row = storage + (j - 1) * pitch * e;
+			VF p0 = LNV(fetch)(row - e, cell, type);
+			VF p1 = LNV(fetch)(row, cell, type);
+			VF p2 = LNV(fetch)(row + e, cell, type);
+			VF p3 = LNV(fetch)(row + 2 * e, cell, type);
+			v[j] = LNV(cubic)(p0, p1, p2, p3, r1);
+		}
+
+		VF_STORE(out + i, LNV(clamp01)(LNV(cubic)(v[0], v[1], v[2], v[3], r2)));
+	}
+
+	for (; i < n; ++i)
+		out[i] = noise2d_sample(lattice, xs[i], ys[i]);
+}
+
+/*
+	The offsets along one axis of a bricked lattice of the four taps around 
+	cell, see axis_offset. shift is log2 of the distance between neighbouring 
+	values along the axis within a brick.
+*/
+LNV_TARGET static inline void LNV(brick_footprint)(
+	VI cell, 
+	VI stride, 
+	int shift, 
+	VI off[4])
+{
+	for (int t = 0; t < 4; ++t)
+	{
+		/* Counted from the start of the apron, which is one before cell - 1. */
+		VI i = VI_ADD(cell, VI_SET1(t));
+		off[t] = VI_ADD(
+			VI_MUL(VI_SRL(i, 2), stride), 
+			VI_SLL(VI_AND(i, VI_SET1(LN_BRICK_EDGE - 1)), shift));
+	}
+}
+
+/*
+	Vector version of ln_lattice_noise3d_batch, see LNV(noise2d_batch). The
+	footprint is a 4x4x4 block, reduced along x, then y, then z.
+
+	In a bricked lattice the taps are not at fixed distances from the cell, 
+	so we work out their offsets along each axis and add them up per tap.
+*/
+LNV_TARGET static void LNV(noise3d_batch)(
+	ln_lattice lattice,
+	float const *xs,
+	float const *ys,
+	float const *zs,
+	float *out,
+	size_t n)
+{
+	char const *storage = lattice->storage;
+	unsigned int type = lattice->value_type;
+	ptrdiff_t e = (ptrdiff_t) value_size(type);
+
+	VF m = VF_SET1((float) lattice->dim_length);
+	VF inv_m = VF_SET1(1.0f / (float) lattice->dim_length);
+	VF limit = VF_SET1(SIMD_COORD_LIMIT);
+	ptrdiff_t pitch = lattice->pitch;
+	ptrdiff_t slice = pitch * pitch;
+	VI vpitch = VI_SET1((int) pitch);
+	VI vslice = VI_SET1((int) slice);
+	VI mask = VI_SET1((int) lattice->dim_length - 1);
+	int pow2 = (lattice->flags & LN_LATTICE_POW2) != 0;
+
+	int bricked = (lattice->flags & LN_LATTICE_BRICKED) != 0;
+	VI bricks[3];
+	if (bricked)
+	{
+		for (unsigned int a = 0; a < 3; ++a)
+			bricks[a] = VI_SET1((int) brick_stride(lattice, a));
+	}
+
+	size_t i = 0;
+	for (; i + LNV_W <= n; i += LNV_W)
+	{
+		VF x = VF_ABS(VF_LOAD(xs + i));
+		VF y = VF_ABS(VF_LOAD(ys + i));
+		VF z = VF_ABS(VF_LOAD(zs + i));
+
+		if (!VM_ALL(VM_AND(VM_AND(VF_LT(x, limit), VF_LT(y, limit)), VF_LT(z, limit))))
+		{
+			for (size_t k = i; k < i + LNV_W; ++k)
+				out[k] = noise3d_sample(lattice, xs[k], ys[k], zs[k]);
+			continue;
+		}
+
+		VF r1, r2, r3;
+		VI cx = LNV(split_coord)(x, pow2, m, inv_m, mask, &r1);
+		VI cy = LNV(split_coord)(y, pow2, m, inv_m, mask, &r2);
+		VI cz = LNV(split_coord)(z, pow2, m, inv_m, mask, &r3);
+
+		VF v[4];
+		if (bricked)
+		{
+			VI xo[4], yo[4], zo[4];
+			LNV(brick_footprint)(cx, bricks[0], 0, xo);
+			LNV(brick_footprint)(cy, bricks[1], 2, yo);
+			LNV(brick_footprint)(cz, bricks[2], 4, zo);
+			for (int k = 0; k < 4; ++k)
+			{
+				VF u[4];
+				for (int j = 0; j < 4; ++j)
+				{
+					VI row = VI_ADD(zo[k], yo[j]);
+					VF p0 = LNV(fetch)(storage, VI_ADD(row, xo[0]), type);
+					VF p1 = LNV(fetch)(storage, VI_ADD(row, xo[1]), type);
+					VF p2 = LNV(fetch)(storage, VI_ADD(row, xo[2]), type);
+					VF p3 = LNV(fetch)(storage, VI_ADD(row, xo[3]), type);
+					u[j] = LNV(cubic)(p0, p1, p2, p3, r1);
+				}
+				v[k] = LNV(cubic)(u[0], u[1], u[2], u[3], r2);
+			}
+			VF_STORE(out + i, LNV(clamp01)(LNV(cubic)(v[0], v[1], v[2], v[3], r3)));
+			continue;
+		}
+
+		VI cell = VI_ADD(VI_ADD(VI_MUL(cz, vslice), VI_MUL(cy, vpitch)), cx);
+		for (ptrdiff_t k = 0; k < 4; ++k)
+		{
+			VF u[4];
+			for (ptrdiff_t j = 0; j < 4; ++j)
+			{
+				char const *row = storage + ((k - 1) * slice + (j - 1) * pitch) * e;
+				VF p0 = LNV(fetch)(row - e, cell, type);
+				VF p1 = LNV(fetch)(row, cell, type);
+				VF p2 = LNV(fetch)(row + e, cell, type);
+				VF p3 = LNV(fetch)(row + 2 * e, cell, type);
+				u[j] = LNV(cubic)(p0, p1, p2, p3, r1);
+			}
+			v[k] = LNV(cubic)(u[0], u[1], u[2], u[3], r2);
+		}
+
+		VF_STORE(out + i, LNV(clamp01)(LNV(cubic)(v[0], v[1], v[2], v[3], r3)));
+	}
+
+	for (; i < n; ++i)
+		out[i] = noise3d_sample(lattice, xs[i], ys[i], zs[i]);
+}
@@ -0,0 +1,724 @@
+/*
+	2012, Simon Otter
+
+	All rights reserved.
+
+	This is free and unencumbered software released into the public domain.
+
+	Anyone is free to copy, modify, publish, use, compile, sell, or
+	distribute this software, either in source code form or as a compiled
+	binary, for any purpose, commercial or non-commercial, and by any
+	means.
+
+	In jurisdictions that recognize copyright laws, the author or authors
+	of this software dedicate any and all copyright interest in the
+	software to the public domain. We make this dedication for the benefit
+	of the public at large and to the detriment of our heirs and
+	successors. We intend this dedication to be an overt act of
+	relinquishment in perpetuity of all present and future rights to this
+	software under copyright law.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+	OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+	OTHER DEALINGS IN THE SOFTWARE.
+
+	For more information, please refer to <http://unlicense.org/>
+*/
+
+/** \file
+
+	lnbench.c
+
+	Micro-benchmarks for the latticenoise library: every public sampler,
+	lattice creation and rendering and encoding a whole image. It only uses
+	the public interface, so it can be built against any version of the
+	library that has it. Build it with make bench.
+*/
+
+/* For clock_gettime. */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <math.h>
+#include <time.h>
+
+#include "latticenoise.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "parg.h"
+
+#include "bench_clock.h"
+
+#define ABORTIF(expr, ...) \
+	if ((expr)) \
+	{ \
+		fprintf(stderr, __VA_ARGS__); abort(); \
+	}
+
+/* -----------------------------------
+	SETUP.
+   ---------------------------------*/
+
+/* Samples taken by every repetition of the sampler benchmarks. */
+#define SAMPLES (1 << 16)
+
+/* The side of the images rendered by the image benchmarks. */
+#define IMAGE_SIZE 1024
+
+/* Where the file benchmarks save their lattice, removed when done. */
+#define LATTICE_PATH "lnbench.lattice"
+
+/*
+	Everything the benchmarks share, set up once before they run. The
+	coordinates are pseudorandom but the same for every run.
+*/
+typedef struct bench_state_s
+{
+	ln_lattice l1;
+	ln_lattice l2;
+	/* A lattice one shorter than l2, which wraps with modulo instead of a mask. */
+	ln_lattice l2_255;
+	ln_lattice l3;
+	ln_lattice l4;
+	ln_lattice l3_uint16;
+	ln_lattice l3_uint8;
+	ln_lattice l3_half;
+	/* Larger than most L2 caches as floats, by ln_value_type. */
+	ln_lattice l3_large[4];
+	ln_lattice l3_bricked;
+	ln_lattice l1_procedural;
+	ln_lattice l2_procedural;
+	ln_lattice l3_procedural;
+	ln_lattice l4_procedural;
+	/* Coordinates in [0, 1), scaled up by each benchmark. */
+	float *unit[4];
+	/* Scaled coordinates and the output of the batch samplers. */
+	float *coords[4];
+	float *out;
+	/* 
+		Everything the samplers return is added up here, which keeps the 
+		compiler from dropping the calls. The benchmarks add to a local sum and
+		only add that at the end, so the loops do not wait on memory.
+	*/
+	float sink;
+} bench_state;
+
+/* Lattice sizes of the samplers' lattices, by dimension. */
+static unsigned int const lattice_sizes[5] = {0, 4096, 256, 64, 16};
+
+/* The lattice size of bench_state::l3_large. */
+#define LARGE_3D_SIZE 128
+
+void state_init(bench_state *s)
+{
+	uint32_t state = 12345;
+	for (int c = 0; c < 4; ++c)
+	{
+		s->unit[c] = malloc(SAMPLES * sizeof(float));
+		s->coords[c] = malloc(SAMPLES * sizeof(float));
+		ABORTIF(s->unit[c] == NULL || s->coords[c] == NULL, "Out of memory.\n");
+		for (size_t i = 0; i < SAMPLES; ++i)
+		{
+			state = state * 1664525u + 1013904223u;
+			s->unit[c][i] = (float) (state >> 8) / 16777216.0f;
+		}
+	}
+	s->out = malloc((size_t) IMAGE_SIZE * IMAGE_SIZE * sizeof(float));
+
+	s->l1 = ln_lattice_new_seeded(1, lattice_sizes[1], 1);
+	s->l2 = ln_lattice_new_seeded(2, lattice_sizes[2], 1);
+	s->l2_255 = ln_lattice_new_seeded(2, lattice_sizes[2] - 1, 1);
+	s->l3 = ln_lattice_new_seeded(3, lattice_sizes[3], 1);
+	s->l4 = ln_lattice_new_seeded(4, lattice_sizes[4], 1);
+
+	ln_lattice_options options = ln_default_lattice_options();
+	options.seed = 1;
+	options.value_type = LN_VALUE_UINT16;
+	s->l3_uint16 = ln_lattice_new_with_options(3, lattice_sizes[3], &options);
+	options.value_type = LN_VALUE_UINT8;
+	s->l3_uint8 = ln_lattice_new_with_options(3, lattice_sizes[3], &options);
+	options.value_type = LN_VALUE_HALF;
+	s->l3_half = ln_lattice_new_with_options(3, lattice_sizes[3], &options);
+	for (int t = 0; t < 4; ++t)
+	{
+		options.value_type = (ln_value_type) t;
+		s->l3_large[t] = ln_lattice_new_with_options(3, LARGE_3D_SIZE, &options);
+		ABORTIF(s->l3_large[t] == NULL, "Out of memory.\n");
+	}
+	options.value_type = LN_VALUE_FLOAT;
+	options.layout = LN_LAYOUT_BRICKED;
+	s->l3_bricked = ln_lattice_new_with_options(3, lattice_sizes[3], &options);
+	s->l1_procedural = ln_lattice_new_procedural(1, lattice_sizes[1], 1);
+	s->l2_procedural = ln_lattice_new_procedural(2, lattice_sizes[2], 1);
+	s->l3_procedural = ln_lattice_new_procedural(3, lattice_sizes[3], 1);
+	s->l4_procedural = ln_lattice_new_procedural(4, lattice_sizes[4], 1);
+
+	ABORTIF(s->out == NULL || s->l1 == NULL || s->l2 == NULL || s->l2_255 == NULL
+		|| s->l3 == NULL
+		|| s->l4 == NULL || s->l3_uint16 == NULL 
+		|| s->l3_uint8 == NULL || s->l3_half == NULL || s->l3_bricked == NULL
+		|| s->l1_procedural == NULL || s->l2_procedural == NULL
+		|| s->l3_procedural == NULL || s->l4_procedural == NULL, "Out of memory.\n");
+	s->sink = 0.0f;
+}
+
+void state_free(bench_state *s)
+{
+	for (int c = 0; c < 4; ++c)
+	{
+		free(s->unit[c]);
+		free(s->coords[c]);
+	}
+	free(s->out);
+	ln_lattice_free(s->l1);
+	ln_lattice_free(s->l2);
+	ln_lattice_free(s->l2_255);
+	ln_lattice_free(s->l3);
+	ln_lattice_free(s->l4);
+	ln_lattice_free(s->l3_uint16);
+	ln_lattice_free(s->l3_uint8);
+	ln_lattice_free(s->l3_half);
+	for (int t = 0; t < 4; ++t)
+		ln_lattice_free(s->l3_large[t]);
+	ln_lattice_free(s->l3_bricked);
+	ln_lattice_free(s->l1_procedural);
+	ln_lattice_free(s->l2_procedural);
+	ln_lattice_free(s->l3_procedural);
+	ln_lattice_free(s->l4_procedural);
+	remove(LATTICE_PATH);
+}
+
+/*
+	Scales the first dimensions coordinates to cover the lattice once.
+*/
+void scale_coords(bench_state *s, unsigned int dimensions, float scale)
+{
+	for (unsigned int c = 0; c < dimensions; ++c)
+	for (size_t i = 0; i < SAMPLES; ++i)
+		s->coords[c][i] = s->unit[c][i] * scale;
+}
+
+/* -----------------------------------
+	BENCHMARKS.
+
+	Each one does its work once and returns the number of items it did,
+	samples, lattice values or pixels. The setup function, if any, runs once
+	before the timed runs.
+   ---------------------------------*/
+
+typedef struct bench_s
+{
+	char const *name;
+	/* What the items are. */
+	char const *unit;
+	void (*setup)(bench_state *s);
+	size_t (*run)(bench_state *s);
+} bench;
+
+void setup_1d(bench_state *s) { scale_coords(s, 1, (float) lattice_sizes[1]); }
+void setup_2d(bench_state *s) { scale_coords(s, 2, (float) lattice_sizes[2]); }
+void setup_3d(bench_state *s) { scale_coords(s, 3, (float) lattice_sizes[3]); }
+void setup_4d(bench_state *s) { scale_coords(s, 4, (float) lattice_sizes[4]); }
+void setup_3d_large(bench_state *s) { scale_coords(s, 3, (float) LARGE_3D_SIZE); }
+
+/* The ln_lattice_value* benchmarks use the coordinates rounded down. */
+size_t run_value1(bench_state *s)
+{
+	float sum = 0.0f;
+	for (size_t i = 0; i < SAMPLES; ++i)
+		sum += ln_lattice_value1(s->l1, (unsigned int) s->coords[0][i]);
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t run_value2(bench_state *s)
+{
+	float sum = 0.0f;
+	for (size_t i = 0; i < SAMPLES; ++i)
+	{
+		sum += ln_lattice_value2(s->l2,
+			(unsigned int) s->coords[0][i], (unsigned int) s->coords[1][i]);
+	}
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t run_value3(bench_state *s)
+{
+	float sum = 0.0f;
+	for (size_t i = 0; i < SAMPLES; ++i)
+	{
+		sum += ln_lattice_value3(s->l3, (unsigned int) s->coords[0][i],
+			(unsigned int) s->coords[1][i], (unsigned int) s->coords[2][i]);
+	}
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t run_value4(bench_state *s)
+{
+	float sum = 0.0f;
+	for (size_t i = 0; i < SAMPLES; ++i)
+	{
+		sum += ln_lattice_value4(s->l4, (unsigned int) s->coords[0][i],
+			(unsigned int) s->coords[1][i], (unsigned int) s->coords[2][i],
+			(unsigned int) s->coords[3][i]);
+	}
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t noise1d(bench_state *s, ln_lattice lattice)
+{
+	float sum = 0.0f;
+	for (size_t i = 0; i < SAMPLES; ++i)
+		sum += ln_lattice_noise1d(lattice, s->coords[0][i]);
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t run_noise1d(bench_state *s) { return noise1d(s, s->l1); }
+size_t run_noise1d_procedural(bench_state *s) { return noise1d(s, s->l1_procedural); }
+
+size_t noise2d(bench_state *s, ln_lattice lattice)
+{
+	float sum = 0.0f;
+	for (size_t i = 0; i < SAMPLES; ++i)
+		sum += ln_lattice_noise2d(lattice, s->coords[0][i], s->coords[1][i]);
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t noise2d_batch(bench_state *s, ln_lattice lattice)
+{
+	ln_lattice_noise2d_batch(lattice, s->coords[0], s->coords[1], s->out, SAMPLES);
+	return SAMPLES;
+}
+
+size_t run_noise2d(bench_state *s) { return noise2d(s, s->l2); }
+size_t run_noise2d_batch(bench_state *s) { return noise2d_batch(s, s->l2); }
+size_t run_noise2d_procedural(bench_state *s) { return noise2d(s, s->l2_procedural); }
+
+/* 
+	The same coordinates on a power-of-two lattice, wrapped with a mask, and 
+	on one that is not, wrapped with modulo.
+*/
+void setup_2d_wrap(bench_state *s) { scale_coords(s, 2, (float) lattice_sizes[2] - 1.0f); }
+size_t run_noise2d_255(bench_state *s) { return noise2d(s, s->l2_255); }
+size_t run_noise2d_batch_255(bench_state *s) { return noise2d_batch(s, s->l2_255); }
+
+/* A row and a grid along the axes, 1/4 lattice point apart. */
+size_t run_noise2d_span(bench_state *s)
+{
+	for (unsigned int y = 0; y < 64; ++y)
+		ln_lattice_noise2d_span(s->l2, 0.0f, 0.25f, (float) y * 0.25f, 1024, s->out + y * 1024);
+	return 64 * 1024;
+}
+
+size_t run_noise2d_grid(bench_state *s)
+{
+	ln_lattice_noise2d_grid(s->l2, 0.0f, 0.0f, 0.25f, 0.25f, 256, 256, s->out, 256);
+	return 256 * 256;
+}
+
+size_t noise3d(bench_state *s, ln_lattice lattice)
+{
+	float sum = 0.0f;
+	for (size_t i = 0; i < SAMPLES; ++i)
+	{
+		sum += ln_lattice_noise3d(lattice,
+			s->coords[0][i], s->coords[1][i], s->coords[2][i]);
+	}
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t run_noise3d(bench_state *s) { return noise3d(s, s->l3); }
+size_t run_noise3d_uint16(bench_state *s) { return noise3d(s, s->l3_uint16); }
+size_t run_noise3d_uint8(bench_state *s) { return noise3d(s, s->l3_uint8); }
+size_t run_noise3d_half(bench_state *s) { return noise3d(s, s->l3_half); }
+
+size_t noise3d_batch(bench_state *s, ln_lattice lattice)
+{
+	ln_lattice_noise3d_batch(lattice,
+		s->coords[0], s->coords[1], s->coords[2], s->out, SAMPLES);
+	return SAMPLES;
+}
+
+size_t run_noise3d_batch(bench_state *s) { return noise3d_batch(s, s->l3); }
+size_t run_noise3d_batch_uint16(bench_state *s) { return noise3d_batch(s, s->l3_uint16); }
+size_t run_noise3d_batch_uint8(bench_state *s) { return noise3d_batch(s, s->l3_uint8); }
+size_t run_noise3d_batch_half(bench_state *s) { return noise3d_batch(s, s->l3_half); }
+size_t run_noise3d_batch_bricked(bench_state *s) { return noise3d_batch(s, s->l3_bricked); }
+size_t run_noise3d_batch_procedural(bench_state *s) { return noise3d_batch(s, s->l3_procedural); }
+
+/* The value types again, on a lattice that does not fit in the cache as floats. */
+size_t run_noise3d_batch_large(bench_state *s) { return noise3d_batch(s, s->l3_large[LN_VALUE_FLOAT]); }
+size_t run_noise3d_batch_large_uint16(bench_state *s) { return noise3d_batch(s, s->l3_large[LN_VALUE_UINT16]); }
+size_t run_noise3d_batch_large_uint8(bench_state *s) { return noise3d_batch(s, s->l3_large[LN_VALUE_UINT8]); }
+size_t run_noise3d_batch_large_half(bench_state *s) { return noise3d_batch(s, s->l3_large[LN_VALUE_HALF]); }
+
+size_t noise4d(bench_state *s, ln_lattice lattice)
+{
+	float sum = 0.0f;
+	for (size_t i = 0; i < SAMPLES; ++i)
+	{
+		sum += ln_lattice_noise4d(lattice,
+			s->coords[0][i], s->coords[1][i], s->coords[2][i], s->coords[3][i]);
+	}
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t run_noise4d(bench_state *s) { return noise4d(s, s->l4); }
+size_t run_noise4d_procedural(bench_state *s) { return noise4d(s, s->l4_procedural); }
+
+size_t run_noise4d_smooth(bench_state *s)
+{
+	float sum = 0.0f;
+	for (size_t i = 0; i < SAMPLES; ++i)
+	{
+		sum += ln_lattice_noise4d_smooth(s->l4,
+			s->coords[0][i], s->coords[1][i], s->coords[2][i], s->coords[3][i]);
+	}
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t run_noise4d_batch(bench_state *s)
+{
+	ln_lattice_noise4d_batch(s->l4,
+		s->coords[0], s->coords[1], s->coords[2], s->coords[3], s->out, SAMPLES);
+	return SAMPLES;
+}
+
+size_t run_noise4d_smooth_batch(bench_state *s)
+{
+	ln_lattice_noise4d_smooth_batch(s->l4,
+		s->coords[0], s->coords[1], s->coords[2], s->coords[3], s->out, SAMPLES);
+	return SAMPLES;
+}
+
+/* The fractal sums use the default options, 4 octaves. */
+size_t run_fsum1d(bench_state *s)
+{
+	float sum = 0.0f;
+	ln_fsum_options opts = ln_default_fsum_options();
+	for (size_t i = 0; i < SAMPLES; ++i)
+		sum += ln_lattice_fsum1d(s->l1, s->coords[0][i], &opts);
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t run_fsum2d(bench_state *s)
+{
+	float sum = 0.0f;
+	ln_fsum_options opts = ln_default_fsum_options();
+	for (size_t i = 0; i < SAMPLES; ++i)
+		sum += ln_lattice_fsum2d(s->l2, s->coords[0][i], s->coords[1][i], &opts);
+	s->sink += sum;
+	return SAMPLES;
+}
+
+size_t run_fsum2d_batch(bench_state *s)
+{
+	ln_fsum_options opts = ln_default_fsum_options();
+	ln_lattice_fsum2d_batch(s->l2, s->coords[0], s->coords[1], s->out, SAMPLES, &opts);
+	return SAMPLES;
+}
+
+size_t run_fsum2d_grid(bench_state *s)
+{
+	ln_fsum_options opts = ln_default_fsum_options();
+	ln_lattice_fsum2d_grid(s->l2, 0.0f, 0.0f, 0.25f, 0.25f, 256, 256, s->out, 256, &opts);
+	return 256 * 256;
+}
+
+size_t run_fsum2d_grid_terrain(bench_state *s)
+{
+	ln_fsum_options opts = ln_default_fsum_options();
+	opts.mode = LN_FSUM_HETERO_TERRAIN;
+	ln_lattice_fsum2d_grid(s->l2, 0.0f, 0.0f, 0.25f, 0.25f, 256, 256, s->out, 256, &opts);
+	return 256 * 256;
+}
+
+/* Lattice creation, the items are the lattice values. */
+size_t create(ln_lattice lattice)
+{
+	ABORTIF(lattice == NULL, "Out of memory.\n");
+	size_t size = (size_t) lattice->size;
+	ln_lattice_free(lattice);
+	return size;
+}
+
+size_t run_create_2d_256(bench_state *s) { return create(ln_lattice_new_seeded(2, 256, 1)); }
+size_t run_create_2d_4096(bench_state *s) { return create(ln_lattice_new_seeded(2, 4096, 1)); }
+size_t run_create_3d_128(bench_state *s) { return create(ln_lattice_new_seeded(3, 128, 1)); }
+size_t run_create_3d_256(bench_state *s) { return create(ln_lattice_new_seeded(3, 256, 1)); }
+size_t run_create_4d_32(bench_state *s) { return create(ln_lattice_new_seeded(4, 32, 1)); }
+size_t run_create_2d_4096_rng(bench_state *s) { return create(ln_lattice_new(2, 4096, NULL)); }
+
+size_t run_create_3d_256_uint8(bench_state *s)
+{
+	ln_lattice_options options = ln_default_lattice_options();
+	options.value_type = LN_VALUE_UINT8;
+	return create(ln_lattice_new_with_options(3, 256, &options));
+}
+
+size_t run_create_3d_256_bricked(bench_state *s)
+{
+	ln_lattice_options options = ln_default_lattice_options();
+	options.layout = LN_LAYOUT_BRICKED;
+	return create(ln_lattice_new_with_options(3, 256, &options));
+}
+
+/* 
+	Saving and opening a lattice file, the items are the lattice values. 
+	
+	The setup also saves a lattice that was opened from a file and opens that
+	file again, which has to work just like with a created lattice.
+*/
+void setup_file(bench_state *s)
+{
+	ABORTIF(!ln_lattice_save(s->l3, LATTICE_PATH), "Could not save %s.\n", LATTICE_PATH);
+	ln_lattice opened = ln_lattice_open(LATTICE_PATH, 1);
+	ABORTIF(opened == NULL, "Could not open %s.\n", LATTICE_PATH);
+	ABORTIF(!ln_lattice_save(opened, LATTICE_PATH), 
+		"Could not save the lattice opened from %s.\n", LATTICE_PATH);
+	ln_lattice_free(opened);
+	opened = ln_lattice_open(LATTICE_PATH, 1);
+	ABORTIF(opened == NULL, "Could not open %s after saving an opened lattice.\n", LATTICE_PATH);
+	ABORTIF(ln_lattice_value3(opened, 1, 2, 3) != ln_lattice_value3(s->l3, 1, 2, 3), 
+		"%s does not hold the saved lattice.\n", LATTICE_PATH);
+	ln_lattice_free(opened);
+}
+
+size_t run_save(bench_state *s)
+{
+	ABORTIF(!ln_lattice_save(s->l3, LATTICE_PATH), "Could not save %s.\n", LATTICE_PATH);
+	return (size_t) s->l3->size;
+}
+
+size_t run_open(bench_state *s)
+{
+	ln_lattice lattice = ln_lattice_open(LATTICE_PATH, 0);
+	ABORTIF(lattice == NULL, "Could not open %s.\n", LATTICE_PATH);
+	s->sink += ln_lattice_value3(lattice, 1, 2, 3);
+	size_t size = (size_t) lattice->size;
+	ln_lattice_free(lattice);
+	return size;
+}
+
+/*
+	Whole images, like mknoise makes them: sample, convert to 8-bit RGB and
+	encode as PNG in memory. The items are pixels.
+*/
+void count_bytes(void *context, void *data, int size)
+{
+	(void) data;
+	*(size_t *) context += (size_t) size;
+}
+
+size_t encode_image(bench_state *s)
+{
+	size_t pixels = (size_t) IMAGE_SIZE * IMAGE_SIZE;
+	unsigned char *rgb = malloc(pixels * 3);
+	ABORTIF(rgb == NULL, "Out of memory.\n");
+	for (size_t i = 0; i < pixels; ++i)
+	{
+		float v = s->out[i];
+		v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+		rgb[i * 3 + 0] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = (unsigned char) (v * 254.999f);
+	}
+	size_t bytes = 0;
+	stbi_write_png_to_func(&count_bytes, &bytes, IMAGE_SIZE, IMAGE_SIZE, 3, rgb, IMAGE_SIZE * 3);
+	free(rgb);
+	s->sink += (float) bytes;
+	return pixels;
+}
+
+size_t run_image_value(bench_state *s)
+{
+	float d = 4.0f / IMAGE_SIZE;
+	ln_lattice_noise2d_grid(s->l2, 0.0f, 0.0f, d, d, IMAGE_SIZE, IMAGE_SIZE, s->out, IMAGE_SIZE);
+	return encode_image(s);
+}
+
+size_t run_image_fsum(bench_state *s)
+{
+	float d = 4.0f / IMAGE_SIZE;
+	ln_fsum_options opts = ln_default_fsum_options();
+	float norm = 1.0f / ln_fsum_max_value(&opts);
+	ln_lattice_fsum2d_grid(s->l2, 0.0f, 0.0f, d, d, IMAGE_SIZE, IMAGE_SIZE, s->out, IMAGE_SIZE, &opts);
+	for (size_t i = 0; i < IMAGE_SIZE * IMAGE_SIZE; ++i)
+		s->out[i] *= norm;
+	return encode_image(s);
+}
+
+static bench const benches[] =
+{
+	{"value1", "sample", &setup_1d, &run_value1},
+	{"value2", "sample", &setup_2d, &run_value2},
+	{"value3", "sample", &setup_3d, &run_value3},
+	{"value4", "sample", &setup_4d, &run_value4},
+	{"noise1d", "sample", &setup_1d, &run_noise1d},
+	{"noise1d_procedural", "sample", &setup_1d, &run_noise1d_procedural},
+	{"noise2d", "sample", &setup_2d, &run_noise2d},
+	{"noise2d_batch", "sample", &setup_2d, &run_noise2d_batch},
+	{"noise2d_procedural", "sample", &setup_2d, &run_noise2d_procedural},
+	{"noise2d_wrap_255", "sample", &setup_2d_wrap, &run_noise2d_255},
+	{"noise2d_wrap_256", "sample", &setup_2d_wrap, &run_noise2d},
+	{"noise2d_batch_wrap_255", "sample", &setup_2d_wrap, &run_noise2d_batch_255},
+	{"noise2d_batch_wrap_256", "sample", &setup_2d_wrap, &run_noise2d_batch},
+	{"noise2d_span", "sample", NULL, &run_noise2d_span},
+	{"noise2d_grid", "sample", NULL, &run_noise2d_grid},
+	{"noise3d", "sample", &setup_3d, &run_noise3d},
+	{"noise3d_uint16", "sample", &setup_3d, &run_noise3d_uint16},
+	{"noise3d_uint8", "sample", &setup_3d, &run_noise3d_uint8},
+	{"noise3d_half", "sample", &setup_3d, &run_noise3d_half},
+	{"noise3d_batch", "sample", &setup_3d, &run_noise3d_batch},
+	{"noise3d_batch_uint16", "sample", &setup_3d, &run_noise3d_batch_uint16},
+	{"noise3d_batch_uint8", "sample", &setup_3d, &run_noise3d_batch_uint8},
+	{"noise3d_batch_half", "sample", &setup_3d, &run_noise3d_batch_half},
+	{"noise3d_batch_bricked", "sample", &setup_3d, &run_noise3d_batch_bricked},
+	{"noise3d_batch_procedural", "sample", &setup_3d, &run_noise3d_batch_procedural},
+	{"noise3d_batch_large", "sample", &setup_3d_large, &run_noise3d_batch_large},
+	{"noise3d_batch_large_uint16", "sample", &setup_3d_large, &run_noise3d_batch_large_uint16},
+	{"noise3d_batch_large_uint8", "sample", &setup_3d_large, &run_noise3d_batch_large_uint8},
+	{"noise3d_batch_large_half", "sample", &setup_3d_large, &run_noise3d_batch_large_half},
+	{"noise4d", "sample", &setup_4d, &run_noise4d},
+	{"noise4d_procedural", "sample", &setup_4d, &run_noise4d_procedural},
+	{"noise4d_smooth", "sample", &setup_4d, &run_noise4d_smooth},
+	{"noise4d_batch", "sample", &setup_4d, &run_noise4d_batch},
+	{"noise4d_smooth_batch", "sample", &setup_4d, &run_noise4d_smooth_batch},
+	{"fsum1d", "sample", &setup_1d, &run_fsum1d},
+	{"fsum2d", "sample", &setup_2d, &run_fsum2d},
+	{"fsum2d_batch", "sample", &setup_2d, &run_fsum2d_batch},
+	{"fsum2d_grid", "sample", NULL, &run_fsum2d_grid},
+	{"fsum2d_grid_terrain", "sample", NULL, &run_fsum2d_grid_terrain},
+	{"create_2d_256", "value", NULL, &run_create_2d_256},
+	{"create_2d_4096", "value", NULL, &run_create_2d_4096},
+	{"create_2d_4096_rng", "value", NULL, &run_create_2d_4096_rng},
+	{"create_3d_128", "value", NULL, &run_create_3d_128},
+	{"create_3d_256", "value", NULL, &run_create_3d_256},
+	{"create_3d_256_uint8", "value", NULL, &run_create_3d_256_uint8},
+	{"create_3d_256_bricked", "value", NULL, &run_create_3d_256_bricked},
+	{"create_4d_32", "value", NULL, &run_create_4d_32},
+	{"save_3d_64", "value", &setup_file, &run_save},
+	{"open_3d_64", "value", &setup_file, &run_open},
+	{"image_value_png", "pixel", NULL, &run_image_value},
+	{"image_fsum_png", "pixel", NULL, &run_image_fsum},
+};
+
+/* -----------------------------------
+	TIMING AND REPORTING.
+   ---------------------------------*/
+
+volatile float bench_sink;
+
+int main(int argc, char *argv[])
+{
+	unsigned int repetitions = 9;
+	int csv = 0;
+	char const *filter = NULL;
+
+	struct parg_state ps;
+	parg_init(&ps);
+	int c;
+	while ((c = parg_getopt(&ps, argc, argv, "hcr:f:")) != -1)
+	{
+		switch (c)
+		{
+			case 'c':
+				csv = 1;
+				break;
+			case 'r':
+				if (atoi(ps.optarg) < 1)
+				{
+					fprintf(stderr, "ARGS: Invalid number of repetitions %s.\n", ps.optarg);
+					return 2;
+				}
+				repetitions = (unsigned int) atoi(ps.optarg);
+				break;
+			case 'f':
+				filter = ps.optarg;
+				break;
+			case 'h':
+				fprintf(stdout, "Usage: lnbench [-h] [-c] [-r N] [-f NAME]\n");
+				fprintf(stdout, "       -h\tprint this help\n");
+				fprintf(stdout, "       -c\twrite the results as CSV\n");
+				fprintf(stdout, "       -r\ttimes to repeat each benchmark, 9 by default\n");
+				fprintf(stdout, "       -f\tonly run the benchmarks whose names contain NAME\n");
+				return 0;
+			default:
+				fprintf(stderr, "ARGS: Unknown option -%c\n", c);
+				return 2;
+		}
+	}
+
+	bench_state state;
+	state_init(&state);
+	double *times = malloc(repetitions * sizeof(double));
+	ABORTIF(times == NULL, "Out of memory.\n");
+
+	if (csv)
+		puts("benchmark,unit,items,repetitions,min_ns,median_ns,max_ns");
+	else
+	{
+		printf("%-26s %10s %12s %12s %12s\n",
+			"benchmark", "items", "min ns", "median ns", "max ns");
+	}
+
+	for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); ++b)
+	{
+		bench const *bench = &benches[b];
+		if (filter != NULL && strstr(bench->name, filter) == NULL)
+			continue;
+
+		if (bench->setup != NULL)
+			bench->setup(&state);
+
+		/* One run to warm up the caches, then the timed ones. */
+		size_t items = bench->run(&state);
+		for (unsigned int r = 0; r < repetitions; ++r)
+		{
+			double start = bench_now();
+			bench->run(&state);
+			times[r] = (bench_now() - start) * 1e9 / (double) items;
+		}
+		qsort(times, repetitions, sizeof(double), &compare_doubles);
+
+		double min = times[0];
+		double median = times[(repetitions - 1) / 2];
+		double max = times[repetitions - 1];
+		if (csv)
+		{
+			printf("%s,%s,%lu,%u,%.3f,%.3f,%.3f\n", bench->name, bench->unit,
+				(long unsigned) items, repetitions, min, median, max);
+		}
+		else
+		{
+			printf("%-26s %10lu %12.2f %12.2f %12.2f  ns/%s\n", bench->name,
+				(long unsigned) items, min, median, max, bench->unit);
+		}
+		fflush(stdout);
+	}
+
+	bench_sink = state.sink;
+
+	free(times);
+	state_free(&state);
+	return 0;
+}
@@ -35,6 +35,11 @@
 	Implements the mknoise program that complements the latticenoise library.
 */
 
+/* For sysconf and clock_gettime. */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,6 +49,15 @@
 #include <math.h>
 #include <time.h>
 
+#ifdef LN_USE_PTHREADS
+#include <pthread.h>
+#endif
+
+/* For sysconf. */
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
 #include "latticenoise.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -51,6 +65,8 @@
 
 #include "parg.h"
 
+#include "bench_clock.h"
+
 #define PRINTERRF(...) fprintf(stderr, __VA_ARGS__)
 #define ABORTIF(expr, ...) \
 	if ((expr)) \
@@ -83,11 +99,19 @@ uint32_t utf8_strlen(char *str)
 #define NOISE_FORMAT_TGA		3
 #define NOISE_FORMAT_BMP		4
 
+#define BENCH_REPORT_TEXT		0
+#define BENCH_REPORT_CSV		1
+#define BENCH_REPORT_JSON		2
+
 
 typedef	struct mknoise_args_s
 {
 	/* Whether to run benchmark instead. */
 	uint32_t benchmark;
+	/* How to report the benchmark results, one of BENCH_REPORT_*. */
+	uint32_t report;
+	/* Times every benchmark is repeated. */
+	uint32_t repetitions;
 	/* Method to use for noise creation. */
 	uint32_t method;
 	char     outpath[0xFFF];	
@@ -99,6 +123,10 @@ typedef	struct mknoise_args_s
 	uint16_t outpath_len;
 	/* Value to seed the RNG with. */
 	uint32_t seed;
+	/* Whether a seed was given, a random one is picked otherwise. */
+	uint32_t has_seed;
+	/* Threads to render with, 0 for one per processor. */
+	uint32_t threads;
 	/* File format. */
 	uint8_t	format;	
 	/* Scale for the lattice, basically how a pixel position maps to the lattice
@@ -106,6 +134,8 @@ typedef	struct mknoise_args_s
 	float 	scale;
 	/* Iterations when doing fractal sum. */
 	ln_fsum_options fsum_opts;
+	/* Whether to leave out fractal sum octaves that don't show in the image. */
+	uint32_t trim_octaves;
 } mknoise_args;
 
 uint8_t find_format_from_path(char const *path)
@@ -158,12 +188,14 @@ void parse_options(int argc, char *argv[], mknoise_args *out)
 	struct parg_state ps;
 	
 	out->scale = 4.0f;
+	out->threads = 1;
+	out->repetitions = 15;
 	out->fsum_opts = ln_default_fsum_options();
 
 	parg_init(&ps);
 	int c;
 	int nonoptions = 0;
-	while ((c = parg_getopt(&ps, argc, argv, "hm:s:bS:n:")) != -1)
+	while ((c = parg_getopt(&ps, argc, argv, "hm:s:bS:n:d:tj:F:r:")) != -1)
 	{
 		switch (c)
 		{
@@ -190,11 +222,47 @@ void parse_options(int argc, char *argv[], mknoise_args *out)
 			case 'b':
 				out->benchmark = 1;
 				break;
+			case 'F':
+				if (strcmp(ps.optarg, "text") == 0)
+					out->report = BENCH_REPORT_TEXT;
+				else if (strcmp(ps.optarg, "csv") == 0)
+					out->report = BENCH_REPORT_CSV;
+				else if (strcmp(ps.optarg, "json") == 0)
+					out->report = BENCH_REPORT_JSON;
+				else
+				{
+					fprintf(stderr, "ARGS: Unknown report format: %s\n", ps.optarg);
+					exit(-3);
+				}
+				break;
+			case 'r':
+				if (atoi(ps.optarg) < 1)
+				{
+					fprintf(stderr, "ARGS: Invalid number of repetitions %s.\n", ps.optarg);
+					exit(-3);
+				}
+				out->repetitions = (uint32_t) atoi(ps.optarg);
+				break;
 			case 'm':
 				if (strcmp(ps.optarg, "fsum") == 0)
 				{
 					out->method = NOISE_METHOD_FSUM;
 				}
+				else if (strcmp(ps.optarg, "turbulence") == 0)
+				{
+					out->method = NOISE_METHOD_FSUM;
+					out->fsum_opts.mode = LN_FSUM_TURBULENCE;
+				}
+				else if (strcmp(ps.optarg, "ridged") == 0)
+				{
+					out->method = NOISE_METHOD_FSUM;
+					out->fsum_opts.mode = LN_FSUM_RIDGED;
+				}
+				else if (strcmp(ps.optarg, "terrain") == 0)
+				{
+					out->method = NOISE_METHOD_FSUM;
+					out->fsum_opts.mode = LN_FSUM_HETERO_TERRAIN;
+				}
 				else if (strcmp(ps.optarg, "value") == 0)
 				{
 					out->method = NOISE_METHOD_VALUE;					
@@ -206,7 +274,8 @@ void parse_options(int argc, char *argv[], mknoise_args *out)
 				}
 				break;
 			case 's':
-				out->seed = atoi(ps.optarg);
+				out->seed = (uint32_t) strtoul(ps.optarg, NULL, 10);
+				out->has_seed = 1;
 				break;
 			case 'n':
 				out->fsum_opts.n = atoi(ps.optarg);
@@ -216,15 +285,37 @@ void parse_options(int argc, char *argv[], mknoise_args *out)
 					exit(-3);
 				}
 				break;
+			case 'd':
+				out->fsum_opts.octave_seed = (unsigned int) strtoul(ps.optarg, NULL, 10);
+				break;
+			case 't':
+				out->trim_octaves = 1;
+				break;
+			case 'j':
+				if (atoi(ps.optarg) < 0)
+				{
+					fprintf(stderr, "ARGS: Invalid number of threads %s.\n", ps.optarg);
+					exit(-3);
+				}
+				out->threads = (uint32_t) atoi(ps.optarg);
+				break;
 			case 'h':
-				fprintf(stdout, "Usage: mknoise [-m] [-h] WIDTH HEIGHT FILENAME\n");
-				fprintf(stdout, "       -m\tmethod flag, has options value ");
-				fprintf(stdout, "and fsum. fsum is a fractal sum which gives ");
-				fprintf(stdout, "a more turbulent kind of noise\n");
+				fprintf(stdout, "Usage: mknoise [-h] [-m METHOD] [-S SCALE] [-s SEED] [-n N] [-d SEED] [-t]\n");
+				fprintf(stdout, "               [-j THREADS] WIDTH HEIGHT FILENAME\n");
+				fprintf(stdout, "       mknoise -b [-F FORMAT] [-r N] [-s SEED]\n");
 				fprintf(stdout, "       -h\tprint this help\n");
-				fprintf(stdout, "       -b\trun benchmarks.\n");
-				fprintf(stdout, "       -S\tset noise frequency scale.\n");
-				fprintf(stdout, "       -n\twhen using fsum method, sets the iterations\n");
+				fprintf(stdout, "       -m\tmethod, value (the default), fsum, turbulence, ridged or terrain. ");
+				fprintf(stdout, "fsum is a fractal sum which gives a more turbulent kind of noise. ");
+				fprintf(stdout, "turbulence, ridged and terrain are fractal sums of those kinds\n");
+				fprintf(stdout, "       -S\tnoise frequency scale, 4 by default\n");
+				fprintf(stdout, "       -s\tseed, the same seed and options always give the same image\n");
+				fprintf(stdout, "       -n\twith a fractal sum method, the number of octaves\n");
+				fprintf(stdout, "       -d\twith a fractal sum method, shifts each octave by an offset from this seed\n");
+				fprintf(stdout, "       -t\twith a fractal sum method, leaves out octaves too faint or too fine to show\n");
+				fprintf(stdout, "       -j\tthreads to render with, 0 for one per processor, 1 by default\n");
+				fprintf(stdout, "       -b\trun benchmarks instead of making an image\n");
+				fprintf(stdout, "       -F\tbenchmark report format, text (the default), csv or json\n");
+				fprintf(stdout, "       -r\ttimes to repeat each benchmark, 15 by default\n");
 				exit(0);
 				break;
 			case '?':
@@ -236,6 +327,10 @@ void parse_options(int argc, char *argv[], mknoise_args *out)
 		}
 	}
 	
+	/* Benchmarks are always run on the same lattices unless asked not to. */
+	if (!out->has_seed)
+		out->seed = out->benchmark ? 0 : (uint32_t) time(NULL);
+
 	if (out->benchmark != 1)
 	{
 		if (out->width == 0 || out->height == 0)
@@ -248,85 +343,222 @@ void parse_options(int argc, char *argv[], mknoise_args *out)
 			fputs("ARGS: Missing argument.", stderr);
 			exit(-2);
 		}
+
+		/*
+			An octave is too faint when the rest of the sum can't change a 
+			pixel by a level, and too fine when its lattice cells are smaller 
+			than two pixels.
+		*/
+		if (out->trim_octaves)
+		{
+			float dx = fabsf(out->scale) / (float) out->width;
+			float dy = fabsf(out->scale) / (float) out->height;
+			out->fsum_opts.tolerance = ln_fsum_max_value(&out->fsum_opts) / 255.0f;
+			out->fsum_opts.sample_spacing = dx > dy ? dx : dy;
+		}
 	}
 	
 	out->format = find_format_from_path(out->outpath);
 }
 
 /* -----------------------------------
-	TEST FUNCTIONS. 
+	BENCHMARKS. 
    ---------------------------------*/
 
-void benchmark()
+/* Samples taken in every repetition of a benchmark. */
+#define BENCH_SAMPLES (1 << 17)
+
+typedef struct bench_case_s
 {
-	#if 0
-	ln_lattice lattice = ln_lattice_new(2, 128, NULL);
-	
-	tga_data *tga = tga_create(4096, 4096, 24);
+	char const *name;
+	unsigned int dimensions;
+	unsigned int lattice_size;
+	/* Octaves for the fractal sums, 0 for plain noise. */
+	unsigned int octaves;
+} bench_case;
+
+static bench_case const bench_cases[] = 
+{
+	{"noise1d", 1, 256, 0},
+	{"noise1d", 1, 65536, 0},
+	{"noise1d", 1, 1048576, 0},
+	{"fsum1d", 1, 256, 1},
+	{"fsum1d", 1, 256, 4},
+	{"fsum1d", 1, 256, 8},
+	{"fsum1d", 1, 65536, 8},
+	{"noise2d", 2, 16, 0},
+	{"noise2d", 2, 256, 0},
+	{"noise2d", 2, 4096, 0},
+	{"fsum2d", 2, 256, 1},
+	{"fsum2d", 2, 256, 4},
+	{"fsum2d", 2, 256, 8},
+	{"fsum2d", 2, 4096, 8},
+};
+
+typedef struct bench_result_s
+{
+	/* Nanoseconds per sample, over the repetitions. */
+	double min;
+	double median;
+	double p99;
+} bench_result;
 
-	uint64_t len = tga_len(tga->width, tga->height, 24) / 3;
-	
-	float *vals = malloc(len * 3 * sizeof(float));
-	ABORTIF(vals == NULL, "Out of memory.\n");
+/*
+	Takes the samples of one repetition. The sum keeps the compiler from 
+	dropping the calls.
+*/
+float bench_run(
+	bench_case const *bench, 
+	ln_lattice lattice, 
+	ln_fsum_options const *opts,
+	float const *xs, 
+	float const *ys)
+{
+	float sum = 0.0f;
+	switch (bench->dimensions * 2 + (bench->octaves > 0))
+	{
+		case 2:
+			for (size_t i = 0; i < BENCH_SAMPLES; ++i)
+				sum += ln_lattice_noise1d(lattice, xs[i]);
+			break;
+		case 3:
+			for (size_t i = 0; i < BENCH_SAMPLES; ++i)
+				sum += ln_lattice_fsum1d(lattice, xs[i], opts);
+			break;
+		case 4:
+			for (size_t i = 0; i < BENCH_SAMPLES; ++i)
+				sum += ln_lattice_noise2d(lattice, xs[i], ys[i]);
+			break;
+		default:
+			for (size_t i = 0; i < BENCH_SAMPLES; ++i)
+				sum += ln_lattice_fsum2d(lattice, xs[i], ys[i], opts);
+			break;
+	}
+	return sum;
+}
 
-	printf("Benchmarking started...\n");
+/*
+	Runs one benchmark: a repetition to warm up, then the timed ones. The 
+	percentiles are nearest rank.
+*/
+bench_result bench_case_run(
+	bench_case const *bench, 
+	mknoise_args const *args,
+	float const *xs, 
+	float const *ys)
+{
+	ln_lattice lattice = ln_lattice_new_seeded(
+		bench->dimensions, bench->lattice_size, args->seed);
+	double *times = malloc(args->repetitions * sizeof(double));
+	ABORTIF(lattice == NULL || times == NULL, "Out of memory.\n");
 
-	float maxN = 1.0;
+	ln_fsum_options opts = ln_default_fsum_options();
+	opts.n = bench->octaves;
 
-	int loops = 10; double secs_acc = 0.0;
-	for (int loop_i = 0; loop_i < loops; ++loop_i)
+	volatile float sink = bench_run(bench, lattice, &opts, xs, ys);
+	for (uint32_t r = 0; r < args->repetitions; ++r)
 	{
-		clock_t start, end;
-		start = clock();
-
-		for (uint64_t i = 0; i < len; ++i)
-		{
-			uint64_t offset = i * 3;
-			float x = ((float) (i % 4096)) / 4.0f;
-			float y = ((float) (i / 4096)) / 4.0f;
-
-			float n = 
-				ln_lattice_noise2d(lattice, x, y);
-			if (n == INFINITY)
-				puts("Bug in ln_lattice_noise2d somewhere.");
-			if (n > maxN)
-				maxN = n;
-			vals[offset] = n;
-			vals[offset+1] = n;
-			vals[offset+2] = n;
-		}
-		end = clock();
-		secs_acc += ((double) (end - start)) / CLOCKS_PER_SEC;
+		double start = bench_now();
+		sink += bench_run(bench, lattice, &opts, xs, ys);
+		times[r] = (bench_now() - start) * 1e9 / BENCH_SAMPLES;
 	}
+	(void) sink;
 
-	printf("Average Seconds Spent: %f.\n", secs_acc / loops);
+	qsort(times, args->repetitions, sizeof(double), &compare_doubles);
+	bench_result result;
+	uint32_t n = args->repetitions;
+	result.min = times[0];
+	result.median = times[(n - 1) / 2];
+	result.p99 = times[(n * 99 + 99) / 100 - 1];
 
-	/* We are no longer in the [0.0, 1.0) range, so we'll have to
-	   scale the range back to 0.0 - 1.0. */
-	float rescale = 1.0 / maxN;
-	for (uint64_t i = 0; i < len; ++i)
+	free(times);
+	ln_lattice_free(lattice);
+	return result;
+}
+
+void benchmark(mknoise_args const *args)
+{
+	/* 
+		The same pseudorandom coordinates in [0, 1) for every run, scaled up to
+		cover the whole lattice by each benchmark.
+	*/
+	float *xs = malloc(BENCH_SAMPLES * sizeof(float));
+	float *ys = malloc(BENCH_SAMPLES * sizeof(float));
+	ABORTIF(xs == NULL || ys == NULL, "Out of memory.\n");
+
+	uint32_t state = 12345;
+	float *coords[2] = {xs, ys};
+	for (int c = 0; c < 2; ++c)
+	for (size_t i = 0; i < BENCH_SAMPLES; ++i)
 	{
-		uint64_t offset = i * 3;
-		float v = vals[offset] * rescale;
-		uint8_t x = (uint8_t)(v * 255.f);
-		tga->data[offset] =   x;
-		tga->data[offset+1] = x;
-		tga->data[offset+2] = x;
+		state = state * 1664525u + 1013904223u;
+		coords[c][i] = (float) (state >> 8) / 16777216.0f;
 	}
 
-	free(vals);
+	size_t count = sizeof(bench_cases) / sizeof(bench_cases[0]);
+	if (args->report == BENCH_REPORT_TEXT)
+	{
+		printf("Seed %lu, %d samples, %lu repetitions.\n", 
+			(long unsigned) args->seed, BENCH_SAMPLES, (long unsigned) args->repetitions);
+		printf("%-10s %10s %8s %12s %12s %12s %12s\n", 
+			"benchmark", "lattice", "octaves", "Msamples/s", "min ns", "median ns", "p99 ns");
+	}
+	else if (args->report == BENCH_REPORT_CSV)
+		puts("benchmark,lattice_size,octaves,samples,repetitions,msamples_per_s,min_ns,median_ns,p99_ns");
+	else
+	{
+		printf("{\n\t\"seed\": %lu,\n\t\"samples\": %d,\n\t\"repetitions\": %lu,\n\t\"results\": [\n", 
+			(long unsigned) args->seed, BENCH_SAMPLES, (long unsigned) args->repetitions);
+	}
 
-	FILE *f = fopen("test.tga", "wb");
+	for (size_t b = 0; b < count; ++b)
+	{
+		bench_case const *bench = &bench_cases[b];
+
+		/* The points cover the lattice once, whatever its size. */
+		float scale = (float) bench->lattice_size;
+		float *bx = malloc(BENCH_SAMPLES * sizeof(float));
+		float *by = malloc(BENCH_SAMPLES * sizeof(float));
+		ABORTIF(bx == NULL || by == NULL, "Out of memory.\n");
+		for (size_t i = 0; i < BENCH_SAMPLES; ++i)
+		{
+			bx[i] = xs[i] * scale;
+			by[i] = ys[i] * scale;
+		}
 
-	tga_write(tga, f);
+		bench_result r = bench_case_run(bench, args, bx, by);
+		double msamples = 1e3 / r.median;
+		free(bx);
+		free(by);
 
-	tga_free(tga);
+		switch (args->report)
+		{
+			case BENCH_REPORT_TEXT:
+				printf("%-10s %10u %8u %12.2f %12.2f %12.2f %12.2f\n", 
+					bench->name, bench->lattice_size, bench->octaves, 
+					msamples, r.min, r.median, r.p99);
+				break;
+			case BENCH_REPORT_CSV:
+				printf("%s,%u,%u,%d,%lu,%.3f,%.3f,%.3f,%.3f\n", 
+					bench->name, bench->lattice_size, bench->octaves, BENCH_SAMPLES, 
+					(long unsigned) args->repetitions, msamples, r.min, r.median, r.p99);
+				break;
+			default:
+				printf("\t\t{\"benchmark\": \"%s\", \"lattice_size\": %u, \"octaves\": %u, "
+					"\"msamples_per_s\": %.3f, \"min_ns\": %.3f, \"median_ns\": %.3f, "
+					"\"p99_ns\": %.3f}%s\n", 
+					bench->name, bench->lattice_size, bench->octaves, 
+					msamples, r.min, r.median, r.p99, b + 1 < count ? "," : "");
+				break;
+		}
+		fflush(stdout);
+	}
 
-	fclose(f);
+	if (args->report == BENCH_REPORT_JSON)
+		puts("\t]\n}");
 
-	ln_lattice_free(lattice);
-	#endif
-	puts("Benchmarking not implemented.");
+	free(xs);
+	free(ys);
 }
 
 int write_image_data(char const *fname, uint8_t format, int width, int height, void const *data)
@@ -350,7 +582,7 @@ int write_image_data(char const *fname, uint8_t format, int width, int height, v
 	return 1;
 }
 
-inline float clamp01(float v)
+inline static float clamp01(float v)
 {
     if (v < 0.0f)
     {
@@ -363,6 +595,166 @@ inline float clamp01(float v)
     return v;
 }
 
+/* -----------------------------------
+	RENDERING.
+   ---------------------------------*/
+
+/* 
+	The image is rendered in tiles of this many pixels square. The threads take
+	the next tile from a shared counter whenever they are done with one, so a 
+	thread that gets cheap tiles simply does more of them.
+*/
+#define TILE_SIZE 64
+
+typedef struct render_job_s
+{
+	mknoise_args const *args;
+	ln_lattice lattice;
+	/* The noise values for the whole image. */
+	float *vals;
+	float fsumnorm;
+	uint32_t tiles_x;
+	uint32_t tiles;
+	/* The next tile nobody has taken yet. */
+	uint32_t next;
+	/* Set when a tile failed to render. */
+	int failed;
+#ifdef LN_USE_PTHREADS
+	pthread_mutex_t lock;
+#endif
+} render_job;
+
+/*
+	Renders one tile into job->vals. Tiles never overlap, so the threads can 
+	write their tiles without locking. The lattice is only read.
+
+	The grid samplers get the coordinates of the tile's first pixel, so the 
+	result does not depend on the number of threads either.
+*/
+int render_tile(render_job *job, uint32_t tile)
+{
+	mknoise_args const *args = job->args;
+	size_t x0 = (size_t) (tile % job->tiles_x) * TILE_SIZE;
+	size_t y0 = (size_t) (tile / job->tiles_x) * TILE_SIZE;
+	size_t w = args->width - x0 < TILE_SIZE ? args->width - x0 : TILE_SIZE;
+	size_t h = args->height - y0 < TILE_SIZE ? args->height - y0 : TILE_SIZE;
+	float dx = args->scale / (float) args->width;
+	float dy = args->scale / (float) args->height;
+	float *vals = job->vals + y0 * args->width + x0;
+
+	if (args->method != NOISE_METHOD_FSUM)
+	{
+		return ln_lattice_noise2d_grid(
+			job->lattice, (float) x0 * dx, (float) y0 * dy, dx, dy, w, h, 
+			vals, args->width);
+	}
+
+	if (!ln_lattice_fsum2d_grid(
+		job->lattice, (float) x0 * dx, (float) y0 * dy, dx, dy, w, h, 
+		vals, args->width, &args->fsum_opts))
+	{
+		return 0;
+	}
+	for (size_t y = 0; y < h; ++y)
+	{
+		for (size_t x = 0; x < w; ++x)
+			vals[y * args->width + x] *= job->fsumnorm;
+	}
+	return 1;
+}
+
+/*
+	Takes the next tile to render, returns 0 when there are none left.
+*/
+int take_tile(render_job *job, uint32_t *tile)
+{
+#ifdef LN_USE_PTHREADS
+	pthread_mutex_lock(&job->lock);
+#endif
+	int taken = job->next < job->tiles && !job->failed;
+	if (taken)
+		*tile = job->next++;
+#ifdef LN_USE_PTHREADS
+	pthread_mutex_unlock(&job->lock);
+#endif
+	return taken;
+}
+
+void *render_worker(void *arg)
+{
+	render_job *job = arg;
+	uint32_t tile;
+	while (take_tile(job, &tile))
+	{
+		if (render_tile(job, tile))
+			continue;
+#ifdef LN_USE_PTHREADS
+		pthread_mutex_lock(&job->lock);
+#endif
+		job->failed = 1;
+#ifdef LN_USE_PTHREADS
+		pthread_mutex_unlock(&job->lock);
+#endif
+	}
+	return NULL;
+}
+
+/*
+	Renders the noise values of the whole image with up to threads threads, 
+	the calling one included. Returns 0 if any tile failed.
+*/
+int render_image(render_job *job, uint32_t threads)
+{
+	mknoise_args const *args = job->args;
+	job->tiles_x = (args->width + TILE_SIZE - 1) / TILE_SIZE;
+	job->tiles = job->tiles_x * ((args->height + TILE_SIZE - 1) / TILE_SIZE);
+	job->next = 0;
+	job->failed = 0;
+	if (threads > job->tiles)
+		threads = job->tiles;
+
+#ifdef LN_USE_PTHREADS
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_t *ids = threads > 1 ? malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+	uint32_t started = 0;
+	if (ids != NULL)
+	{
+		for (; started < threads - 1; ++started)
+		{
+			if (pthread_create(&ids[started], NULL, &render_worker, job))
+				break;
+		}
+	}
+	render_worker(job);
+	for (uint32_t i = 0; i < started; ++i)
+		pthread_join(ids[i], NULL);
+	free(ids);
+	pthread_mutex_destroy(&job->lock);
+#else
+	(void) threads;
+	render_worker(job);
+#endif
+
+	return !job->failed;
+}
+
+/*
+	The number of threads to render with, -j 0 means one per processor. 
+	Without pthreads there is only the one.
+*/
+uint32_t render_threads(mknoise_args const *args)
+{
+#ifdef LN_USE_PTHREADS
+	if (args->threads != 0)
+		return args->threads;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (uint32_t) cpus : 1;
+#else
+	(void) args;
+	return 1;
+#endif
+}
+
 void output_noise_image(mknoise_args const *args)
 {
 	char *rgb = malloc(sizeof(char) * 3 * args->width * args->height);
@@ -373,8 +765,13 @@ void output_noise_image(mknoise_args const *args)
 	
 	/* Todo: Make lattice size a setting. */ 
 	unsigned int lattice_size = 256;
-	ln_lattice lattice = ln_lattice_new(2, lattice_size, NULL);
+	ln_lattice lattice = ln_lattice_new_seeded(2, lattice_size, args->seed);
 	printf("Using a lattice of size %d.\n", lattice_size);
+	if (args->has_seed)
+		printf("Using seed %lu.\n", (long unsigned) args->seed);
+	else
+		printf("Using seed %lu, pass -s %lu to get the same image again.\n", 
+			(long unsigned) args->seed, (long unsigned) args->seed);
 	
 	if (lattice == NULL)
 	{
@@ -385,33 +782,50 @@ void output_noise_image(mknoise_args const *args)
 	float fsumnorm = 1.0f / ln_fsum_max_value(&args->fsum_opts);
 	printf("Fractal sum normalizing constant = %f.\n", fsumnorm);
 	
+	/* The noise values for the whole image. */
+	float *vals = malloc(sizeof(float) * args->width * args->height);
+	if (vals == NULL)
+	{
+		ln_lattice_free(lattice);
+		free(rgb);
+		EPRINT_AND_EXIT("Could not allocate value buffer.", -4);
+	}
+	
+	float dx = args->scale / (float) args->width;
+	float dy = args->scale / (float) args->height;
+	
+	uint32_t threads = render_threads(args);
+	printf("Rendering with %lu thread%s.\n", (long unsigned) threads, threads == 1 ? "" : "s");
+
+	render_job job;
+	job.args = args;
+	job.lattice = lattice;
+	job.vals = vals;
+	job.fsumnorm = fsumnorm;
+	if (!render_image(&job, threads))
+		EPRINT_AND_EXIT("Grid sampling failed, possibly memory error.", -4);
+	
 	for (size_t y = 0; y < args->height; ++y)
 	{
-		float fy = (float) y / ((float) args->height) * args->scale;
 		for (size_t x = 0; x < args->width; ++x)
 		{
 			size_t offset = (y * args->width + x) * 3;
-			float fx = (float) x / ((float) args->width) * args->scale;
-			float v = 0.0f;
-			if (args->method != NOISE_METHOD_FSUM)
-				v = ln_lattice_noise2d(lattice, fx, fy);
-			else
-				v = ln_lattice_fsum2d(lattice, fx, fy, &args->fsum_opts) * fsumnorm;
+			float v = vals[y * args->width + x];
 			if (v == INFINITY)
 				EPRINT_AND_EXIT("Value with infinity detected, bug in library.", -100);
 			
 			v = clamp01(v);
 			if (v != v) 
-				printf("Found a NAN for (%0.2f, %0.2f).\n", fx, fy);
+				printf("Found a NAN for (%0.2f, %0.2f).\n", (float) x * dx, (float) y * dy);
 			
 			rgb[offset + 0] = (char) (v * 254.999f);
 			rgb[offset + 1] = (char) (v * 254.999f);
 			rgb[offset + 2] = (char) (v * 254.999f);
-			//printf("n(%0.2f, %0.2f) = %f\n", fx, fy, v);
-			//printf("p(%0.2f, %0.2f) = (%03c,%03c,%03c)\n", fx, fy, rgb[offset + 0], rgb[offset + 1], rgb[offset + 2]);
 		}
 	}
 	
+	free(vals);
+	
 	if (!write_image_data(
 		args->outpath, 
 		args->format,
@@ -432,12 +846,12 @@ void output_noise_image(mknoise_args const *args)
 
 int main(int argc, char *argv[])
 {
-	mknoise_args args;
+	mknoise_args args = {0};
 	parse_options(argc, argv, &args);
 	
 	if (args.benchmark == 1)
 	{
-		benchmark();		
+		benchmark(&args);
 	}
 	else 
 	{